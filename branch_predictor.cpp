@@ -0,0 +1,232 @@
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "branch_predictor.h"
+using namespace std;
+
+const char *const branch_predictor_names[] = {
+  "static", "bimodal", "gshare", "tournament", "perceptron", nullptr
+};
+
+// Backward taken, forward not taken.
+class static_predictor : public branch_predictor {
+ public:
+  bool predict(int pc, int target, uint64_t) override {
+    return target <= pc;
+  }
+  void update(int, int, uint64_t, bool) override {}
+  uint64_t num_changes() const override { return 0; }
+};
+
+// A table of 2-bit saturating counters, initially weakly not taken.
+class counter_table {
+ public:
+  explicit counter_table(int num_entries)
+    : counters(num_entries, 1), changes(0) {}
+  bool predict(uint32_t index) const {
+    return counters[index & (counters.size()-1)] >= 2;
+  }
+  void update(uint32_t index, bool taken) {
+    uint8_t &c = counters[index & (counters.size()-1)];
+    if(taken && c < 3) {
+      ++c;
+      ++changes;
+    }
+    if(!taken && c > 0) {
+      --c;
+      ++changes;
+    }
+  }
+  uint64_t num_changes() const { return changes; }
+ private:
+  vector<uint8_t> counters;
+  uint64_t changes;
+};
+
+// Counters indexed by pc.
+class bimodal_predictor : public branch_predictor {
+ public:
+  explicit bimodal_predictor(int table_entries)
+    : table(table_entries) {}
+  bool predict(int pc, int, uint64_t) override {
+    return table.predict(pc);
+  }
+  void update(int pc, int, uint64_t, bool taken) override {
+    table.update(pc, taken);
+  }
+  uint64_t num_changes() const override {
+    return table.num_changes();
+  }
+ private:
+  counter_table table;
+};
+
+// Counters indexed by pc xor global history.
+class gshare_predictor : public branch_predictor {
+ public:
+  gshare_predictor(int table_entries, int history_length)
+    : table(table_entries),
+      history_mask(history_length >= 64 ?
+                   ~(uint64_t)0 : ((uint64_t)1 << history_length) - 1) {}
+  bool predict(int pc, int, uint64_t history) override {
+    return table.predict(index(pc, history));
+  }
+  void update(int pc, int, uint64_t history, bool taken) override {
+    table.update(index(pc, history), taken);
+  }
+  uint64_t num_changes() const override {
+    return table.num_changes();
+  }
+ private:
+  uint32_t index(int pc, uint64_t history) const {
+    return pc ^ (uint32_t)(history & history_mask);
+  }
+  counter_table table;
+  uint64_t history_mask;
+};
+
+// Chooses between bimodal and gshare with per-pc counters, which move
+// towards the component that was right when they disagree.
+class tournament_predictor : public branch_predictor {
+ public:
+  tournament_predictor(int table_entries, int history_length)
+    : local(table_entries), global(table_entries, history_length),
+      chooser(table_entries) {}
+  bool predict(int pc, int target, uint64_t history) override {
+    return chooser.predict(pc) ?
+      global.predict(pc, target, history) :
+      local.predict(pc, target, history);
+  }
+  void update(int pc, int target, uint64_t history, bool taken) override {
+    bool local_taken = local.predict(pc, target, history);
+    bool global_taken = global.predict(pc, target, history);
+    if(local_taken != global_taken) {
+      chooser.update(pc, global_taken == taken);
+    }
+    local.update(pc, target, history, taken);
+    global.update(pc, target, history, taken);
+  }
+  uint64_t num_changes() const override {
+    return local.num_changes() + global.num_changes() +
+      chooser.num_changes();
+  }
+ private:
+  bimodal_predictor local;
+  gshare_predictor global;
+  counter_table chooser;
+};
+
+// Perceptrons indexed by pc over the global history (Jimenez and Lin),
+// with 8-bit weights.
+class perceptron_predictor : public branch_predictor {
+ public:
+  perceptron_predictor(int table_entries, int history_length)
+    : history_length(history_length),
+      threshold(1.93 * history_length + 14),
+      weights(table_entries * (history_length+1), 0), changes(0) {}
+  bool predict(int pc, int, uint64_t history) override {
+    return output(pc, history) >= 0;
+  }
+  void update(int pc, int, uint64_t history, bool taken) override {
+    int y = output(pc, history);
+    if((y >= 0) == taken && abs(y) > threshold) return;
+    int8_t *w = row(pc);
+    train(w[0], taken);
+    for(int i = 0; i < history_length; ++i) {
+      train(w[i+1], ((history >> i) & 1) == taken);
+    }
+  }
+  uint64_t num_changes() const override { return changes; }
+ private:
+  int8_t *row(int pc) {
+    int num_rows = weights.size() / (history_length+1);
+    return &weights[(pc & (num_rows-1)) * (history_length+1)];
+  }
+  int output(int pc, uint64_t history) {
+    const int8_t *w = row(pc);
+    int y = w[0];
+    for(int i = 0; i < history_length; ++i) {
+      y += ((history >> i) & 1) ? w[i+1] : -w[i+1];
+    }
+    return y;
+  }
+  void train(int8_t &w, bool agree) {
+    if(agree && w < 127) {
+      ++w;
+      ++changes;
+    }
+    if(!agree && w > -127) {
+      --w;
+      ++changes;
+    }
+  }
+  int history_length;
+  int threshold;
+  vector<int8_t> weights;
+  uint64_t changes;
+};
+
+unique_ptr<branch_predictor> make_branch_predictor(
+    const string &name, int table_entries, int history_length) {
+  branch_predictor *ret = nullptr;
+  if(name == "static") {
+    ret = new static_predictor();
+  } else if(name == "bimodal") {
+    ret = new bimodal_predictor(table_entries);
+  } else if(name == "gshare") {
+    ret = new gshare_predictor(table_entries, history_length);
+  } else if(name == "tournament") {
+    ret = new tournament_predictor(table_entries, history_length);
+  } else if(name == "perceptron") {
+    ret = new perceptron_predictor(table_entries, history_length);
+  }
+  return unique_ptr<branch_predictor>(ret);
+}
+
+branch_target_buffer::branch_target_buffer(int num_entries, int num_ways)
+  : num_ways(num_ways), num_sets(num_entries / num_ways), clock(0),
+    changes(0), entries(num_entries, entry{false, 0, 0, 0}) {}
+
+// A use of the most recently used entry of a set does not change its LRU
+// order.
+bool branch_target_buffer::most_recent(const entry *set,
+                                       const entry &e) const {
+  for(int i = 0; i < num_ways; ++i) {
+    if(set[i].valid && set[i].last_use > e.last_use) return false;
+  }
+  return true;
+}
+
+int branch_target_buffer::lookup(int pc) {
+  entry *set = &entries[(pc & (num_sets-1)) * num_ways];
+  for(int i = 0; i < num_ways; ++i) {
+    if(set[i].valid && set[i].pc == pc) {
+      if(!most_recent(set, set[i])) ++changes;
+      set[i].last_use = ++clock;
+      return set[i].target;
+    }
+  }
+  return -1;
+}
+
+void branch_target_buffer::update(int pc, int target) {
+  entry *set = &entries[(pc & (num_sets-1)) * num_ways];
+  entry *victim = &set[0];
+  for(int i = 0; i < num_ways; ++i) {
+    if(set[i].valid && set[i].pc == pc) {
+      victim = &set[i];
+      break;
+    }
+    if(!set[i].valid ||
+       (victim->valid && set[i].last_use < victim->last_use)) {
+      victim = &set[i];
+    }
+  }
+  if(!(victim->valid && victim->pc == pc && victim->target == target &&
+       most_recent(set, *victim))) {
+    ++changes;
+  }
+  *victim = entry{true, pc, target, ++clock};
+}
@@ -0,0 +1,58 @@
+#ifndef BRANCH_PREDICTOR_H_
+#define BRANCH_PREDICTOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Direction predictor for conditional branches. pc and target are word
+// addresses; history holds the outcomes of the preceding conditional
+// branches, the latest in bit 0. The front end keeps the history
+// speculatively and repairs it on a misprediction, so update() gets the
+// same history that predict() saw.
+class branch_predictor {
+ public:
+  virtual ~branch_predictor() {}
+  virtual bool predict(int pc, int target, uint64_t history) = 0;
+  // Trains with the outcome of a committed branch.
+  virtual void update(int pc, int target, uint64_t history, bool taken) = 0;
+  // Counts the updates that changed the tables, so that comparing machine
+  // states does not need to compare the tables themselves.
+  virtual uint64_t num_changes() const = 0;
+};
+
+extern const char *const branch_predictor_names[];
+
+// Returns nullptr if name is not one of branch_predictor_names.
+std::unique_ptr<branch_predictor> make_branch_predictor(
+    const std::string &name, int table_entries, int history_length);
+
+// Branch target buffer for indirect jumps: a set-associative table from
+// the pc of a JR/JALR to its last target, with LRU replacement.
+class branch_target_buffer {
+ public:
+  branch_target_buffer(int num_entries, int num_ways);
+  bool enabled() const { return !entries.empty(); }
+  // Returns the target, or -1 on a miss.
+  int lookup(int pc);
+  void update(int pc, int target);
+  // Counts the lookups and updates that changed the entries or their LRU
+  // order.
+  uint64_t num_changes() const { return changes; }
+ private:
+  struct entry {
+    bool valid;
+    int pc;
+    int target;
+    uint64_t last_use;
+  };
+  bool most_recent(const entry *set, const entry &e) const;
+  int num_ways;
+  int num_sets;
+  uint64_t clock;
+  uint64_t changes;
+  std::vector<entry> entries;
+};
+
+#endif /* BRANCH_PREDICTOR_H_ */
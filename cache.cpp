@@ -0,0 +1,89 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cache.h"
+using namespace std;
+
+const char *const cache_replacement_names[] = {
+  "lru", "fifo", "random", nullptr
+};
+
+cache::cache(int size, int ways, int line_size, const string &replacement,
+             int hit_latency, int miss_latency)
+  : num_accesses(0), num_misses(0), record_journal(false),
+    num_ways(ways), num_sets(size / line_size / ways),
+    line_shift(__builtin_ctz(line_size)),
+    replacement(replacement == "fifo" ? policy::FIFO :
+                replacement == "random" ? policy::RANDOM : policy::LRU),
+    hit_cycles(hit_latency), miss_cycles(miss_latency),
+    clock(0), random_state(1), changes(0),
+    lines(size / line_size, line{false, 0, 0}) {}
+
+int cache::access(uint32_t address, int pc) {
+  uint32_t tag = address >> line_shift;
+  line *set = &lines[(tag & (num_sets-1)) * num_ways];
+  bool miss = true;
+  line *victim = &set[0];
+  for(int i = 0; i < num_ways; ++i) {
+    if(set[i].valid && set[i].tag == tag) {
+      miss = false;
+      victim = &set[i];
+      break;
+    }
+    if(!set[i].valid ||
+       (victim->valid && set[i].stamp < victim->stamp)) {
+      victim = &set[i];
+    }
+  }
+  if(miss) {
+    if(replacement == policy::RANDOM && victim->valid) {
+      // xorshift32
+      random_state ^= random_state << 13;
+      random_state ^= random_state >> 17;
+      random_state ^= random_state << 5;
+      victim = &set[random_state % num_ways];
+    }
+    *victim = line{true, tag, ++clock};
+    ++changes;
+  } else if(replacement == policy::LRU) {
+    // Using the most recently used line keeps the order.
+    for(int i = 0; i < num_ways; ++i) {
+      if(set[i].valid && set[i].stamp > victim->stamp) {
+        ++changes;
+        break;
+      }
+    }
+    victim->stamp = ++clock;
+  }
+  ++num_accesses;
+  num_misses += miss;
+  if(pc >= 0 && pc < (int)pc_accesses.size()) {
+    ++pc_accesses[pc];
+    pc_misses[pc] += miss;
+    if(record_journal && journal.size() <= max_journal_size) {
+      journal.push_back((uint32_t)pc << 1 | miss);
+    }
+  }
+  return miss ? miss_cycles : hit_cycles;
+}
+
+int cache::probe(uint32_t address) const {
+  uint32_t tag = address >> line_shift;
+  const line *set = &lines[(tag & (num_sets-1)) * num_ways];
+  for(int i = 0; i < num_ways; ++i) {
+    if(set[i].valid && set[i].tag == tag) return hit_cycles;
+  }
+  return miss_cycles;
+}
+
+void cache::enable_pc_stats(int num_pcs) {
+  pc_accesses.assign(num_pcs, 0);
+  pc_misses.assign(num_pcs, 0);
+}
+
+void cache::repeat_journal(size_t begin, uint64_t times) {
+  for(size_t i = begin; i < journal.size(); ++i) {
+    pc_accesses[journal[i] >> 1] += times;
+    pc_misses[journal[i] >> 1] += times * (journal[i] & 1);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern const char *const cache_replacement_names[];
+
+// Timing model of a set-associative cache. Only the tags are kept; the
+// data always comes from ram. A size of 0 disables the cache.
+class cache {
+ public:
+  cache(int size, int ways, int line_size, const std::string &replacement,
+        int hit_latency, int miss_latency);
+  bool enabled() const { return !lines.empty(); }
+  int hit_latency() const { return hit_cycles; }
+  int miss_latency() const { return miss_cycles; }
+  // Looks up the line of a byte address and fills it on a miss. Returns
+  // the latency of the access. pc is the word address of the instruction.
+  int access(uint32_t address, int pc);
+  // Returns the latency access() would take, without changing anything.
+  int probe(uint32_t address) const;
+  int line_size() const { return 1 << line_shift; }
+  // Counts accesses and misses per pc below num_pcs.
+  void enable_pc_stats(int num_pcs);
+  // Counts the accesses that changed the tags or the replacement state,
+  // so that comparing machine states does not need to compare the tags.
+  uint64_t num_changes() const { return changes; }
+
+  uint64_t num_accesses;
+  uint64_t num_misses;
+  std::vector<uint64_t> pc_accesses;
+  std::vector<uint64_t> pc_misses;
+  // While record_journal is set, access() also appends pc<<1|miss, so that
+  // the per-pc counts of a stretch of accesses can be repeated. A journal
+  // longer than max_journal_size is incomplete and stops growing.
+  static const size_t max_journal_size = 1<<16;
+  bool record_journal;
+  std::vector<uint32_t> journal;
+  void repeat_journal(size_t begin, uint64_t times);
+
+ private:
+  enum class policy { LRU, FIFO, RANDOM };
+  struct line {
+    bool valid;
+    uint32_t tag;
+    uint64_t stamp;
+  };
+  int num_ways;
+  int num_sets;
+  int line_shift;
+  policy replacement;
+  int hit_cycles;
+  int miss_cycles;
+  uint64_t clock;
+  uint32_t random_state;
+  uint64_t changes;
+  std::vector<line> lines;
+};
+
+#endif /* CACHE_H_ */
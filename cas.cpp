@@ -3,22 +3,29 @@
 #include <cstdlib>
 #include <cstdio>
 #include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
 #include <sys/time.h>
 #include "consts.h"
 #include "options.h"
+#include "branch_predictor.h"
+#include "cache.h"
 #include "cas.h"
+#include "cas_config.h"
+#include "pipeline_trace.h"
 #include "qkfpu.h"
 using namespace std;
 
 static void do_show_statistics();
 static void show_statistics_and_exit(int status);
 
-const double clk = 66.666e6;
-const double baudrate = 460800.0;
+static double clk;
+static double baudrate;
 const int num_databits = 8;
 const double stopbit = 1.0;
 
-const int clk_per_byte = clk / (baudrate / (num_databits+stopbit+1));
+static int clk_per_byte;
 
 static int recv_queue[1024];
 static int recv_queue_top;
@@ -28,28 +35,37 @@ static bool recv_eof;
 static int send_queue_top;
 static int send_queue_bottom;
 static int send_count;
+// For --skip-idle: counts changes of the RS-232C queues, and is set when
+// the program polls a port that is not ready.
+static uint64_t rs_num_events;
+static bool rs_polled_unready;
 
 inline uint32_t rs_recv_status() {
   if(recv_queue_top == recv_queue_bottom && recv_eof) {
     fprintf(stderr, "LW: End of File reached. Halt.\n");
     show_statistics_and_exit(0);
   }
+  if(recv_queue_top == recv_queue_bottom) rs_polled_unready = true;
   return recv_queue_top != recv_queue_bottom;
 }
 inline uint32_t rs_recv_data() {
   uint32_t ret = recv_queue[recv_queue_top];
   recv_queue_top++;
   recv_queue_top &= 1023;
+  rs_num_events++;
   return ret;
 }
 inline uint32_t rs_send_status() {
-  return send_queue_top != ((send_queue_bottom+1)&1023);
+  bool ready = send_queue_top != ((send_queue_bottom+1)&1023);
+  if(!ready) rs_polled_unready = true;
+  return ready;
 }
 inline void rs_send_data(uint32_t dat) {
   unsigned char ch = dat;
   fwrite(&ch,1,1,stdout);
   send_queue_bottom++;
   send_queue_bottom &= 1023;
+  rs_num_events++;
 }
 
 inline void rs_init() {
@@ -60,6 +76,8 @@ inline void rs_init() {
   send_queue_top = 0;
   send_queue_bottom = 0;
   send_count = 0;
+  rs_num_events = 0;
+  rs_polled_unready = false;
 }
 
 inline void rs_cycle() {
@@ -71,6 +89,7 @@ inline void rs_cycle() {
     if(readsize<1) {
       if(feof(stdin)) {
         recv_eof = true;
+        rs_num_events++;
         return;
       } else {
         fprintf(stderr, "error: reading from input\n");
@@ -85,6 +104,7 @@ inline void rs_cycle() {
     recv_queue_bottom++;
     recv_queue_bottom &= 1023;
     recv_count = clk_per_byte;
+    rs_num_events++;
   }
   if(send_count > 0) {
     --send_count;
@@ -92,6 +112,7 @@ inline void rs_cycle() {
     send_queue_top++;
     send_queue_top &= 1023;
     send_count = clk_per_byte;
+    rs_num_events++;
   }
 }
 
@@ -111,11 +132,12 @@ inline void rs_cycle() {
 
 #define REG_CC0 64
 
-const int TAG_LENGTH = 5;
-const int NUM_TAGS = (1<<TAG_LENGTH);
+// Tags are ROB indices; storage is sized for the largest ROB.
+const int MAX_TAGS = max_rob_size;
+static int num_tags;
 const int REG_LENGTH = 7;
 const int NUM_REGS = (1<<REG_LENGTH);
-const int CDB_SIZE = 7;
+const int MAX_CDB_SIZE = num_units * max_unit_ports;
 
 struct value_tag {
   bool available;
@@ -156,6 +178,32 @@ inline value_tag cdb_available_val(uint32_t value, int tag) {
   return ret;
 }
 
+// Machine state serialized for --skip-idle. Only what can affect later
+// cycles is written, so that equal machine states compare equal.
+struct state_buffer {
+  vector<uint32_t> words;
+  void put(uint32_t w) {
+    words.push_back(w);
+  }
+  void put64(uint64_t w) {
+    put(w);
+    put(w>>32);
+  }
+  // A source operand: either a value or the tag it waits for.
+  void put_operand(const value_tag &vt) {
+    put(vt.available);
+    put(vt.available ? vt.value : vt.tag);
+  }
+  // A result on its way to the CDB.
+  void put_result(const value_tag &vt) {
+    put(vt.available);
+    if(vt.available) {
+      put(vt.value);
+      put(vt.tag);
+    }
+  }
+};
+
 enum class branch_type {
   NONBRANCH,
   JUMP,
@@ -163,8 +211,26 @@ enum class branch_type {
   BRANCH
 };
 
+// What a cycle's commit stage did: commit, or wait for the ROB head to
+// arrive or to be ready. A pending head waits for its own unit, as any
+// older producer has committed.
+enum class CommitStall : int {
+  COMMIT = 0,
+  FRONT_END = 1,
+  REFETCH = 2,
+  LOAD = 3,
+  STORE = 4,
+  BRANCH = 5,
+  ALU = 6,
+  FADD = 7,
+  FMUL = 8,
+  FCMP = 9,
+  FOTHERS = 10,
+};
+const int NumCommitStalls = 11;
+
+// An instruction being dispatched into the ROB.
 struct rob_val {
-  bool busy;
   bool decode_success;
   bool isstore;
   branch_type btype;
@@ -174,24 +240,119 @@ struct rob_val {
   uint32_t predicted_branch;
   int pc;
   int rasp;
+  uint64_t history;
+  CommitStall pending_reason;
+};
+
+// A set of ROB tags (or, equivalently, of ROB entries).
+struct tag_set {
+  static const int num_words = (MAX_TAGS+63)/64;
+  uint64_t words[num_words];
+  void clear() {
+    fill(words, words+num_words, 0);
+  }
+  void set(int tag) {
+    words[tag>>6] |= (uint64_t)1 << (tag&63);
+  }
+  void reset(int tag) {
+    words[tag>>6] &= ~((uint64_t)1 << (tag&63));
+  }
+  bool test(int tag) const {
+    return (words[tag>>6] >> (tag&63)) & 1;
+  }
+  bool intersects(const tag_set &other) const {
+    for(int i = 0; i < num_words; ++i) {
+      if(words[i] & other.words[i]) return true;
+    }
+    return false;
+  }
+  template<typename F>
+  void for_each(F f) const {
+    for(int i = 0; i < num_words; ++i) {
+      for(uint64_t m = words[i]; m; m &= m-1) {
+        f(i*64 + __builtin_ctzll(m));
+      }
+    }
+  }
 };
 
-static value_tag cdb[CDB_SIZE];
+// The results broadcast in this cycle, in the order of the units and
+// their ports.
+static value_tag cdb[MAX_CDB_SIZE];
+static int cdb_size;
+// The CDB indexed by tag: the tags broadcast in this cycle and their values.
+// Structures waiting on a tag are woken through this index instead of
+// scanning the CDB slots.
+static tag_set cdb_tags;
+static uint32_t cdb_values[MAX_TAGS];
 
-inline void reset_cdb() {
-  for(int i = 0; i < CDB_SIZE; ++i) {
-    cdb[i] = cdb_unavailable_val();
+inline void add_to_cdb(const value_tag results[], int n) {
+  for(int i = 0; i < n; ++i) {
+    if(results[i].available) cdb[cdb_size++] = results[i];
   }
 }
 
-inline value_tag snoop(value_tag vt) {
-  if(vt.available) return vt;
-  for(int i = 0; i < CDB_SIZE; ++i) {
-    if(cdb[i].available && vt.tag == cdb[i].tag) {
-      return from_value(cdb[i].value);
+inline void index_cdb() {
+  cdb_tags.clear();
+  for(int i = 0; i < cdb_size; ++i) {
+    // As a tag may appear twice after a flush, the first slot wins.
+    if(!cdb_tags.test(cdb[i].tag)) {
+      cdb_tags.set(cdb[i].tag);
+      cdb_values[cdb[i].tag] = cdb[i].value;
     }
   }
-  return vt;
+}
+
+inline void reset_cdb() {
+  cdb_size = 0;
+  index_cdb();
+}
+
+// With cdb_width slots, a unit issues only if a slot is free in the cycle
+// its result reaches the CDB. The slots are reserved at issue, in the order
+// the units issue, in a ring indexed by cycle.
+static int cdb_width;
+const int cdb_ring_size = 512;
+static int cdb_reservations[cdb_ring_size];
+static uint32_t cdb_cycle;
+
+inline bool reserve_cdb(int latency) {
+  if(cdb_width == 0) return true;
+  int &n = cdb_reservations[(cdb_cycle + latency) & (cdb_ring_size-1)];
+  if(n == cdb_width) return false;
+  ++n;
+  return true;
+}
+
+inline void reset_cdb_reservations() {
+  fill(cdb_reservations, cdb_reservations+cdb_ring_size, 0);
+}
+
+// For --trace: the trace, and the record of the instruction holding each
+// tag, or -1.
+static unique_ptr<pipeline_trace> trace;
+static int trace_ids[MAX_TAGS];
+
+inline void trace_tag(int tag, pipeline_trace::stage s) {
+  if(trace && trace_ids[tag] >= 0) trace->record(trace_ids[tag], s);
+}
+
+inline void trace_retire(int tag, bool flushed) {
+  if(trace && trace_ids[tag] >= 0) {
+    trace->retire(trace_ids[tag], flushed);
+    trace_ids[tag] = -1;
+  }
+}
+
+inline value_tag snoop(value_tag vt) {
+  if(vt.available || !cdb_tags.test(vt.tag)) return vt;
+  return from_value(cdb_values[vt.tag]);
+}
+
+// Adds the tag vt waits on to the tags a structure's entries are waiting
+// on. Bits may be stale, which only costs an unnecessary snoop.
+inline void add_waiting(tag_set &waiting, const value_tag &vt) {
+  if(!vt.available) waiting.set(vt.tag);
 }
 
 template<int num_operands>
@@ -209,56 +370,287 @@ struct rs_entry {
   }
 };
 
-template<int latency, int num_entries, int num_operands>
+// A set of entries of a reservation station or a load/store buffer.
+// Entries stay in their slots; the order among them is kept by the
+// dispatch sequence numbers in ages[].
+typedef uint64_t slot_mask;
+constexpr slot_mask slot_bit(int i) {
+  return (slot_mask)1 << i;
+}
+inline int oldest_slot(slot_mask slots, const uint64_t ages[]) {
+  int ret = __builtin_ctzll(slots);
+  for(slots &= slots-1; slots; slots &= slots-1) {
+    int i = __builtin_ctzll(slots);
+    if(ages[i] < ages[ret]) ret = i;
+  }
+  return ret;
+}
+
+inline slot_mask first_slots(int n) {
+  return n == 64 ? ~(slot_mask)0 : slot_bit(n)-1;
+}
+
+// A template parameter of a unit given by configure() at run time instead.
+// Storage is then sized for the largest value.
+const int runtime_param = -1;
+
+// unit is the operation of the functional unit: it provides num_operands
+// and a static execute() which computes the result of an entry. Each of
+// the ports issues the oldest ready entry left.
+template<int static_latency, int static_entries, int static_ports,
+         typename unit>
 struct reservation_station {
-  rs_entry<num_operands> entries[num_entries];
-  value_tag calculation_pipeline[latency+1];
-  function<uint32_t (const rs_entry<num_operands>&)> fun;
+  static const int num_operands = unit::num_operands;
+  static const int max_latency =
+    static_latency == runtime_param ? max_unit_latency : static_latency;
+  static const int max_entries =
+    static_entries == runtime_param ? max_unit_entries : static_entries;
+  static const int max_ports =
+    static_ports == runtime_param ? max_unit_ports : static_ports;
+  static_assert(max_entries <= 64, "slot_mask is too narrow");
+  int runtime_latency;
+  int runtime_entries;
+  int runtime_ports;
+  rs_entry<num_operands> entries[max_entries];
+  uint64_t ages[max_entries];
+  uint64_t next_age;
+  // Entries in use, and those whose operands are all available.
+  slot_mask busy;
+  slot_mask ready;
+  value_tag calculation_pipeline[max_latency+1][max_ports];
+  tag_set waiting;
+  static bool accepts(int latency, int num_entries, int num_ports) {
+    return (static_latency == runtime_param ||
+            latency == static_latency) &&
+           (static_entries == runtime_param ||
+            num_entries == static_entries) &&
+           (static_ports == runtime_param ||
+            num_ports == static_ports);
+  }
+  void configure(int latency, int num_entries, int num_ports) {
+    runtime_latency = latency;
+    runtime_entries = num_entries;
+    runtime_ports = num_ports;
+  }
+  int latency() const {
+    return static_latency == runtime_param ? runtime_latency : static_latency;
+  }
+  int num_entries() const {
+    return static_entries == runtime_param ? runtime_entries : static_entries;
+  }
+  int num_ports() const {
+    return static_ports == runtime_param ? runtime_ports : static_ports;
+  }
   bool dispatchable() {
-    return !entries[num_entries-1].busy;
+    return busy != first_slots(num_entries());
+  }
+  int num_busy() const {
+    return __builtin_popcountll(busy);
   }
   void do_issue() {
-    for(int i = 0; i < num_entries; ++i) {
-      for(int j = 0; j < num_operands; ++j) {
-        entries[i].operands[j] = snoop(entries[i].operands[j]);
+    if(waiting.intersects(cdb_tags)) {
+      waiting.clear();
+      for(slot_mask m = busy & ~ready; m; m &= m-1) {
+        int i = __builtin_ctzll(m);
+        for(int j = 0; j < num_operands; ++j) {
+          entries[i].operands[j] = snoop(entries[i].operands[j]);
+          add_waiting(waiting, entries[i].operands[j]);
+        }
+        if(entries[i].issuable()) ready |= slot_bit(i);
       }
     }
-    for(int i = 0; i < latency; ++i) {
-      calculation_pipeline[i] = calculation_pipeline[i+1];
-    }
-    value_tag issue = cdb_unavailable_val();
-    {
-      int i;
-      for(i = 0; i < num_entries; ++i) {
-        if(entries[i].issuable()) {
-          issue = cdb_available_val(fun(entries[i]), entries[i].tag);
-          break;
-        }
+    for(int i = 0; i < latency(); ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        calculation_pipeline[i][p] = calculation_pipeline[i+1][p];
       }
-      for(; i < num_entries; ++i) {
-        if(i+1 < num_entries) {
-          entries[i] = entries[i+1];
-        } else {
-          entries[i].busy = false;
-        }
+    }
+    for(int p = 0; p < num_ports(); ++p) {
+      value_tag issue = cdb_unavailable_val();
+      if(ready && reserve_cdb(latency())) {
+        int i = oldest_slot(ready, ages);
+        issue = cdb_available_val(unit::execute(entries[i]), entries[i].tag);
+        trace_tag(entries[i].tag, pipeline_trace::ISSUE);
+        busy &= ~slot_bit(i);
+        ready &= ~slot_bit(i);
       }
+      calculation_pipeline[latency()][p] = issue;
     }
-    calculation_pipeline[latency] = issue;
   }
   void dispatch(const rs_entry<num_operands> &d) {
-    for(int i = 0; i < num_entries; ++i) {
-      if(!entries[i].busy) {
-        entries[i] = d;
-        return;
-      }
+    int i = __builtin_ctzll(~busy);
+    entries[i] = d;
+    ages[i] = next_age++;
+    busy |= slot_bit(i);
+    if(entries[i].issuable()) ready |= slot_bit(i);
+    for(int j = 0; j < num_operands; ++j) {
+      add_waiting(waiting, d.operands[j]);
     }
   }
   void reset() {
-    for(int i = 0; i < num_entries; ++i) {
-      entries[i].busy = false;
+    busy = 0;
+    ready = 0;
+    next_age = 0;
+    for(int i = 0; i <= latency(); ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        calculation_pipeline[i][p].available = false;
+      }
+    }
+    waiting.clear();
+  }
+  void save_state(state_buffer &state) const {
+    // Oldest first, as if the entries were compacted.
+    int n = 0;
+    for(slot_mask m = busy; m; ++n) {
+      int i = oldest_slot(m, ages);
+      m &= ~slot_bit(i);
+      state.put(true);
+      state.put(entries[i].tag);
+      state.put(entries[i].opcode);
+      for(int j = 0; j < num_operands; ++j) {
+        state.put_operand(entries[i].operands[j]);
+      }
+    }
+    for(; n < num_entries(); ++n) state.put(false);
+    for(int i = 0; i <= latency(); ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        state.put_result(calculation_pipeline[i][p]);
+      }
+    }
+  }
+};
+
+// Operations of the functional units.
+struct branch_unit {
+  static const int num_operands = 4;
+  static uint32_t execute(const rs_entry<4> &e) {
+    if((e.opcode&1) ^ (e.operands[0].value == e.operands[1].value)) {
+      return e.operands[3].value;
+    } else {
+      return e.operands[2].value;
+    }
+  }
+};
+struct alu_unit {
+  static const int num_operands = 2;
+  static uint32_t execute(const rs_entry<2> &e) {
+    switch(e.opcode) {
+      case ALU_OP_ADDU:
+        return e.operands[0].value + e.operands[1].value;
+      case ALU_OP_SUBU:
+        return e.operands[0].value - e.operands[1].value;
+      case ALU_OP_AND:
+        return e.operands[0].value & e.operands[1].value;
+      case ALU_OP_OR:
+        return e.operands[0].value | e.operands[1].value;
+      case ALU_OP_XOR:
+        return e.operands[0].value ^ e.operands[1].value;
+      case ALU_OP_NOR:
+        return ~(e.operands[0].value | e.operands[1].value);
+      case ALU_OP_SLT:
+        return (int32_t)e.operands[0].value < (int32_t)e.operands[1].value;
+      case ALU_OP_SLTU:
+        return e.operands[0].value < e.operands[1].value;
+      case ALU_OP_SLL:
+        return e.operands[1].value << (e.operands[0].value&31);
+      case ALU_OP_SRL:
+        return e.operands[1].value >> (e.operands[0].value&31);
+      case ALU_OP_SRA:
+        return (int32_t)e.operands[1].value >> (e.operands[0].value&31);
+      default:
+        fprintf(stderr, "error: unknown ALU opcode %d\n", e.opcode);
+        show_statistics_and_exit(1);
+        return 0;
+    }
+  }
+};
+struct fp_adder_unit {
+  static const int num_operands = 2;
+  static uint32_t execute(const rs_entry<2> &e) {
+    switch(e.opcode) {
+      case 0:
+        if(use_native_fp)
+          return native_fadd(e.operands[0].value, e.operands[1].value);
+        else
+          return fadd(e.operands[0].value, e.operands[1].value);
+      case 1:
+        if(use_native_fp)
+          return native_fsub(e.operands[0].value, e.operands[1].value);
+        else
+          return fsub(e.operands[0].value, e.operands[1].value);
+      case 2:
+        return e.operands[0].value;
+      case 3:
+        return e.operands[0].value ^ 0x80000000U;
+      default:
+        fprintf(stderr, "error: unknown fp_adder opcode %d\n", e.opcode);
+        show_statistics_and_exit(1);
+        return 0;
+    }
+  }
+};
+struct fp_multiplier_unit {
+  static const int num_operands = 2;
+  static uint32_t execute(const rs_entry<2> &e) {
+    if(use_native_fp)
+      return native_fmul(e.operands[0].value, e.operands[1].value);
+    else
+      return fmul(e.operands[0].value, e.operands[1].value);
+  }
+};
+struct fp_comparator_unit {
+  static const int num_operands = 2;
+  static uint32_t execute(const rs_entry<2> &e) {
+    switch(e.opcode) {
+      case 2:
+        if(use_native_fp)
+          return native_feq(e.operands[0].value, e.operands[1].value);
+        else
+          return feq(e.operands[0].value, e.operands[1].value);
+      case 4:
+        if(use_native_fp)
+          return native_flt(e.operands[0].value, e.operands[1].value);
+        else
+          return flt(e.operands[0].value, e.operands[1].value);
+      case 6:
+        if(use_native_fp)
+          return native_fle(e.operands[0].value, e.operands[1].value);
+        else
+          return fle(e.operands[0].value, e.operands[1].value);
+      default:
+        fprintf(stderr, "error: unknown fp_comparator opcode %d\n", e.opcode);
+        show_statistics_and_exit(1);
+        return 0;
     }
-    for(int i = 0; i <= latency; ++i) {
-      calculation_pipeline[i].available = false;
+  }
+};
+struct fp_others_unit {
+  static const int num_operands = 2;
+  static uint32_t execute(const rs_entry<2> &e) {
+    switch(e.opcode) {
+      case 0:
+        if(use_native_fp)
+          return native_fdiv(e.operands[0].value, e.operands[1].value);
+        else
+          return fdiv(e.operands[0].value, e.operands[1].value);
+      case 1:
+        if(use_native_fp)
+          return native_fsqrt(e.operands[0].value);
+        else
+          return fsqrt(e.operands[0].value);
+      case 2:
+        if(use_native_fp)
+          return native_itof(e.operands[0].value);
+        else
+          return itof(e.operands[0].value);
+      case 3:
+        if(use_native_fp)
+          return native_ftoi(e.operands[0].value);
+        else
+          return ftoi(e.operands[0].value);
+      default:
+        fprintf(stderr, "error: unknown fp_others opcode %d\n", e.opcode);
+        show_statistics_and_exit(1);
+        return 0;
     }
   }
 };
@@ -301,111 +693,401 @@ inline void write_ram(uint32_t address, uint32_t data) {
   show_statistics_and_exit(1);
 }
 
+static unique_ptr<cache> icache;
+static unique_ptr<cache> dcache;
+// The pc whose I-cache access is in progress, and the cycles left.
+static int icache_pc;
+static int icache_wait;
+
+// Returns true while the instruction at pc is still on its way from the
+// I-cache. With a hit latency of 1 it never is, as without an I-cache.
+inline bool icache_busy(int pc) {
+  if(!icache->enabled()) return false;
+  if(pc != icache_pc) {
+    icache_pc = pc;
+    icache_wait = icache->access((uint32_t)pc*4, pc) - 1;
+  }
+  if(icache_wait == 0) {
+    icache_pc = -1;
+    return false;
+  }
+  --icache_wait;
+  return true;
+}
+
+// Loads performed by the memory stage, those of them that took their data
+// from a store in the load/store buffer, and those that went before the
+// address of an older store was known. A violation is a speculative load
+// replayed because such a store turned out to write its address.
+static uint64_t num_performed_loads;
+static uint64_t num_forwarded_loads;
+static uint64_t num_speculative_loads;
+static uint64_t num_memory_order_violations;
+static bool store_forwarding;
+static bool speculative_loads;
+
+// data is the value a store writes; age is the dispatch sequence number.
 struct ls_entry1 {
   bool busy;
   int tag;
+  int pc;
   bool isstore;
   value_tag base;
   uint32_t offset;
+  value_tag data;
+  uint64_t age;
 };
 struct ls_entry2 {
   bool busy;
   int tag;
+  int pc;
   bool isstore;
   uint32_t address;
+  value_tag data;
+};
+// A load performed while an older store was still calculating its address.
+struct ls_speculated_load {
+  int tag;
+  uint32_t address;
+  uint64_t age;
 };
 
-template<int num_entries1, int num_entries2>
+// Address calculation (entries1) is in order, so its entries form a ring
+// buffer. Memory access (entries2) may go out of order. Each stage handles
+// up to the number of ports of entries per cycle, but only one store,
+// which is written when it commits. Without a D-cache every access takes
+// latency cycles. With one, I/O accesses take the hit latency, and a miss
+// blocks the memory stage until it is hit latency cycles from its result,
+// so that results never overtake each other.
+//
+// With forwarding, a load whose youngest older access to the same address
+// is a store with its data takes the data in the hit latency instead of
+// waiting for the store to commit. With speculative loads, a load may
+// calculate its address past older entries still waiting for their base,
+// leaving a hole in the ring, and access memory before the older stores
+// have their addresses. Stores and I/O loads still leave in order. A store
+// whose address matches a younger load already performed marks the load
+// in violated, and the commit stage replays it.
+template<int static_entries1, int static_entries2, int static_ports>
 struct load_store_buffer {
   static const int latency = 3;
-  ls_entry1 entries1[num_entries1];
-  ls_entry2 entries2[num_entries2];
-  value_tag calculation_pipeline[latency+1];
-  bool store_committable(int rob_top, bool rob_top_committable) {
-    for(int i = 0; i < num_entries2; ++i) {
-      if(entries2[i].busy && entries2[i].isstore &&
-         rob_top_committable && entries2[i].tag == rob_top) {
-        return true;
-      }
+  static const int max_depth =
+    latency > max_cache_latency ? latency : max_cache_latency;
+  static const int max_entries1 =
+    static_entries1 == runtime_param ? max_unit_entries : static_entries1;
+  static const int max_entries2 =
+    static_entries2 == runtime_param ? max_unit_entries : static_entries2;
+  static const int max_ports =
+    static_ports == runtime_param ? max_unit_ports : static_ports;
+  static_assert(max_entries2 <= 64, "slot_mask is too narrow");
+  int runtime_entries1;
+  int runtime_entries2;
+  int runtime_ports;
+  bool forwarding;
+  bool speculative;
+  // count1 includes the holes left by speculative loads.
+  ls_entry1 entries1[max_entries1];
+  int head1;
+  int count1;
+  int holes1;
+  ls_entry2 entries2[max_entries2];
+  uint64_t ages2[max_entries2];
+  uint64_t next_age;
+  slot_mask busy2;
+  ls_speculated_load speculated[max_rob_size];
+  int num_speculated;
+  tag_set violated;
+  value_tag calculation_pipeline[max_depth+1][max_ports];
+  int depth;
+  int busy_cycles;
+  tag_set waiting;
+  bool store_committable(int tag) {
+    if(busy_cycles > 0) return false;
+    for(slot_mask m = busy2; m; m &= m-1) {
+      int i = __builtin_ctzll(m);
+      if(entries2[i].isstore && entries2[i].tag == tag) return true;
     }
     return false;
   }
+  static bool accepts(int num_entries1, int num_entries2, int num_ports) {
+    return (static_entries1 == runtime_param ||
+            num_entries1 == static_entries1) &&
+           (static_entries2 == runtime_param ||
+            num_entries2 == static_entries2) &&
+           (static_ports == runtime_param ||
+            num_ports == static_ports);
+  }
+  void configure(int num_entries1, int num_entries2, int num_ports,
+                 bool store_forwarding, bool speculative_loads) {
+    runtime_entries1 = num_entries1;
+    runtime_entries2 = num_entries2;
+    runtime_ports = num_ports;
+    forwarding = store_forwarding;
+    speculative = speculative_loads;
+    depth = dcache->enabled() ? dcache->miss_latency() : latency;
+  }
+  static bool is_io(const ls_entry2 &e) {
+    return (e.address>>2) >= (1U<<20);
+  }
+  // The accesses kept in program order with the ROB head.
+  static bool is_ordered_io(uint32_t address) {
+    return (address&0xFFFF0000U) == 0xFFFF0000U;
+  }
+  int forwarding_latency() const {
+    return dcache->enabled() ? dcache->hit_latency() : latency;
+  }
+  // Looks the access up without touching the D-cache.
+  int access_latency(const ls_entry2 &e) const {
+    if(!dcache->enabled()) return latency;
+    if(is_io(e)) return dcache->hit_latency();
+    return dcache->probe(e.address);
+  }
+  int num_entries1() const {
+    return static_entries1 == runtime_param ?
+      runtime_entries1 : static_entries1;
+  }
+  int num_entries2() const {
+    return static_entries2 == runtime_param ?
+      runtime_entries2 : static_entries2;
+  }
+  int num_ports() const {
+    return static_ports == runtime_param ? runtime_ports : static_ports;
+  }
   bool dispatchable() {
-    return !entries1[num_entries1-1].busy;
+    return count1 < num_entries1();
+  }
+  int num_busy1() const {
+    return count1 - holes1;
   }
-  void do_issue(int rob_top, bool rob_top_committable, uint32_t data) {
-    for(int i = 0; i < num_entries1; ++i) {
-      entries1[i].base = snoop(entries1[i].base);
+  int num_busy2() const {
+    return __builtin_popcountll(busy2);
+  }
+  // rob_top is the head of the ROB before this cycle's commits; store_tag
+  // is the store committed in this cycle, or -1.
+  void do_issue(int rob_top, int store_tag, uint32_t store_data) {
+    if(waiting.intersects(cdb_tags)) {
+      waiting.clear();
+      for(int k = 0, i = head1; k < count1; ++k) {
+        entries1[i].base = snoop(entries1[i].base);
+        add_waiting(waiting, entries1[i].base);
+        if(forwarding && entries1[i].isstore) {
+          entries1[i].data = snoop(entries1[i].data);
+          add_waiting(waiting, entries1[i].data);
+        }
+        if(++i == num_entries1()) i = 0;
+      }
+      if(forwarding) {
+        for(slot_mask m = busy2; m; m &= m-1) {
+          ls_entry2 &e = entries2[__builtin_ctzll(m)];
+          if(!e.isstore) continue;
+          e.data = snoop(e.data);
+          add_waiting(waiting, e.data);
+        }
+      }
+    }
+    for(int i = 0; i < depth; ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        calculation_pipeline[i][p] = calculation_pipeline[i+1][p];
+      }
     }
-    for(int i = 0; i < latency; ++i) {
-      calculation_pipeline[i] = calculation_pipeline[i+1];
+    for(int p = 0; p < num_ports(); ++p) {
+      calculation_pipeline[depth][p] = cdb_unavailable_val();
     }
-    ls_entry2 issue1;
-    issue1.busy = false;
-    if(!entries2[num_entries2-1].busy &&
-       entries1[0].busy && entries1[0].base.available) {
-      issue1.busy = true;
-      issue1.tag = entries1[0].tag;
-      issue1.isstore = entries1[0].isstore;
-      issue1.address = entries1[0].base.value + entries1[0].offset;
-      for(int i = 1; i < num_entries1; ++i) {
-        entries1[i-1] = entries1[i];
+    ls_entry2 issue1[max_ports];
+    uint64_t issue1_ages[max_ports];
+    int num_issue1 = 0;
+    int free2 = num_entries2() - __builtin_popcountll(busy2);
+    // Oldest first. An entry goes once all older ones have gone, or, if
+    // speculative, when it is a load of ordinary memory.
+    bool in_order = true;
+    for(int k = 0, i = head1; k < count1; ++k) {
+      if(num_issue1 == num_ports() || num_issue1 == free2) break;
+      ls_entry1 &d = entries1[i];
+      if(++i == num_entries1()) i = 0;
+      if(!d.busy) continue;
+      uint32_t address = d.base.value + d.offset;
+      if(!d.base.available ||
+         (!in_order && (d.isstore || is_ordered_io(address)))) {
+        if(!speculative) break;
+        in_order = false;
+        continue;
       }
-      entries1[num_entries1-1].busy = false;
+      ls_entry2 &e = issue1[num_issue1];
+      issue1_ages[num_issue1++] = d.age;
+      e.busy = true;
+      e.tag = d.tag;
+      e.pc = d.pc;
+      e.isstore = d.isstore;
+      e.address = address;
+      e.data = d.data;
+      trace_tag(e.tag, pipeline_trace::ISSUE);
+      d.busy = false;
+      ++holes1;
     }
-    value_tag issue2 = cdb_unavailable_val();
-    {
-      int i;
-      for(i = 0; i < num_entries2; ++i) {
-        bool issuable =
-          entries2[i].busy &&
-          (!(entries2[i].isstore ||
-             (entries2[i].address&0xFFFF0000U) == 0xFFFF0000U) ||
-           ((!entries2[i].isstore || rob_top_committable) &&
-            entries2[i].tag == rob_top));
-        for(int j = 0; j < i; ++j) {
-          issuable = issuable && entries2[i].address != entries2[j].address;
-        }
-        if(issuable) {
-          if(entries2[i].isstore) {
-            write_ram(entries2[i].address, data);
-          } else {
-            issue2 = cdb_available_val(read_ram(entries2[i].address),
-                                       entries2[i].tag);
-          }
+    while(count1 > 0 && !entries1[head1].busy) {
+      if(++head1 == num_entries1()) head1 = 0;
+      --count1;
+      --holes1;
+    }
+    // Loads younger than the oldest store without an address in the
+    // memory stage yet are speculative; only they need to be remembered.
+    uint64_t unresolved_age = UINT64_MAX;
+    if(speculative) {
+      for(int k = 0, i = head1; k < count1; ++k) {
+        if(entries1[i].busy && entries1[i].isstore) {
+          unresolved_age = entries1[i].age;
           break;
         }
+        if(++i == num_entries1()) i = 0;
+      }
+      for(int k = 0; k < num_issue1; ++k) {
+        if(issue1[k].isstore) {
+          unresolved_age = min(unresolved_age, issue1_ages[k]);
+        }
+      }
+      int n = 0;
+      for(int k = 0; k < num_speculated; ++k) {
+        if(speculated[k].age > unresolved_age) speculated[n++] = speculated[k];
+      }
+      num_speculated = n;
+    }
+    // Oldest first; an access waits for older ones to the same address,
+    // unless it is a load forwarded from the youngest of them.
+    slot_mask issuable_slots = busy2;
+    if(busy_cycles > 0) {
+      --busy_cycles;
+      issuable_slots = 0;
+    }
+    int num_issue2 = 0;
+    for(slot_mask m = issuable_slots; m && num_issue2 < num_ports(); ) {
+      int i = oldest_slot(m, ages2);
+      m &= ~slot_bit(i);
+      const ls_entry2 &e = entries2[i];
+      bool issuable = !(e.isstore || is_ordered_io(e.address)) ||
+        e.tag == (e.isstore ? store_tag : rob_top);
+      int youngest_older = -1;
+      for(slot_mask older = busy2 & ~m & ~slot_bit(i); older;
+          older &= older-1) {
+        int j = __builtin_ctzll(older);
+        if(e.address == entries2[j].address &&
+           (youngest_older < 0 || ages2[j] > ages2[youngest_older])) {
+          youngest_older = j;
+        }
       }
-      for(; i < num_entries2; ++i) {
-        if(i+1 < num_entries2) {
-          entries2[i] = entries2[i+1];
+      bool forwarded = forwarding && youngest_older >= 0 && !e.isstore &&
+        !is_ordered_io(e.address) && entries2[youngest_older].isstore &&
+        entries2[youngest_older].data.available;
+      issuable = issuable && (youngest_older < 0 || forwarded);
+      int access_cycles =
+        forwarded ? forwarding_latency() : access_latency(e);
+      issuable = issuable && (e.isstore || reserve_cdb(access_cycles));
+      if(issuable) {
+        if(dcache->enabled() && !forwarded) {
+          if(!is_io(e)) dcache->access(e.address, e.pc);
+          busy_cycles = max(busy_cycles,
+                            access_cycles - dcache->hit_latency());
+        }
+        if(e.isstore) {
+          write_ram(e.address, store_data);
         } else {
-          entries2[i].busy = false;
+          value_tag *stage = calculation_pipeline[access_cycles];
+          int p = 0;
+          while(stage[p].available) ++p;
+          uint32_t value = forwarded ?
+            entries2[youngest_older].data.value : read_ram(e.address);
+          stage[p] = cdb_available_val(value, e.tag);
+          trace_tag(e.tag, pipeline_trace::MEMORY);
+          num_performed_loads++;
+          num_forwarded_loads += forwarded;
+          if(ages2[i] > unresolved_age) {
+            num_speculative_loads++;
+            speculated[num_speculated++] =
+              ls_speculated_load{e.tag, e.address, ages2[i]};
+          }
         }
+        busy2 &= ~slot_bit(i);
+        ++num_issue2;
       }
     }
-    calculation_pipeline[latency] = issue2;
-    for(int i = 0; i < num_entries2; ++i) {
-      if(!entries2[i].busy) {
-        entries2[i] = issue1;
-        return;
+    for(int k = 0; k < num_issue1; ++k) {
+      int i = __builtin_ctzll(~busy2);
+      entries2[i] = issue1[k];
+      ages2[i] = issue1_ages[k];
+      busy2 |= slot_bit(i);
+      if(!issue1[k].isstore) continue;
+      for(int s = 0; s < num_speculated; ++s) {
+        if(speculated[s].age > issue1_ages[k] &&
+           speculated[s].address == issue1[k].address) {
+          violated.set(speculated[s].tag);
+        }
       }
     }
   }
-  void dispatch(const ls_entry1 &d) {
-    for(int i = 0; i < num_entries1; ++i) {
-      if(!entries1[i].busy) {
-        entries1[i] = d;
-        return;
+  void dispatch(ls_entry1 d) {
+    int i = head1 + count1;
+    if(i >= num_entries1()) i -= num_entries1();
+    d.age = next_age++;
+    entries1[i] = d;
+    ++count1;
+    add_waiting(waiting, d.base);
+    if(forwarding && d.isstore) add_waiting(waiting, d.data);
+  }
+  void reset() {
+    head1 = 0;
+    count1 = 0;
+    holes1 = 0;
+    busy2 = 0;
+    next_age = 0;
+    num_speculated = 0;
+    violated.clear();
+    busy_cycles = 0;
+    for(int i = 0; i <= depth; ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        calculation_pipeline[i][p] = cdb_unavailable_val();
       }
     }
+    waiting.clear();
   }
-  void reset() {
-    for(int i = 0; i < num_entries1; ++i) {
-      entries1[i].busy = false;
+  void save_state(state_buffer &state) const {
+    // Oldest first, as if the entries were compacted.
+    for(int k = 0, i = head1; k < num_entries1(); ++k) {
+      const ls_entry1 &d = entries1[i];
+      if(++i == num_entries1()) i = 0;
+      state.put(k < count1 && d.busy);
+      if(k >= count1 || !d.busy) continue;
+      state.put(d.tag);
+      state.put(d.pc);
+      state.put(d.isstore);
+      state.put_operand(d.base);
+      state.put(d.offset);
+      if(forwarding && d.isstore) state.put_operand(d.data);
+    }
+    int n = 0;
+    for(slot_mask m = busy2; m; ++n) {
+      int i = oldest_slot(m, ages2);
+      m &= ~slot_bit(i);
+      state.put(true);
+      state.put(entries2[i].tag);
+      state.put(entries2[i].pc);
+      state.put(entries2[i].isstore);
+      state.put(entries2[i].address);
+      if(forwarding && entries2[i].isstore) {
+        state.put_operand(entries2[i].data);
+      }
+    }
+    for(; n < num_entries2(); ++n) state.put(false);
+    state.put(num_speculated);
+    for(int k = 0; k < num_speculated; ++k) {
+      state.put(speculated[k].tag);
+      state.put(speculated[k].address);
     }
-    for(int i = 0; i < num_entries2; ++i) {
-      entries2[i].busy = false;
+    violated.for_each([&state](int tag) { state.put(tag); });
+    state.put(-1);
+    state.put(busy_cycles);
+    for(int i = 0; i <= depth; ++i) {
+      for(int p = 0; p < num_ports(); ++p) {
+        state.put_result(calculation_pipeline[i][p]);
+      }
     }
   }
 };
@@ -432,22 +1114,109 @@ static const char regnames[128][7] = {
   "reg124", "reg125", "reg126", "reg127"
 };
 
-static rob_val rob[NUM_TAGS];
+// The reorder buffer, as a structure of arrays indexed by tag. The hot
+// value_tags are kept apart from the fields only read at commit.
+static struct {
+  value_tag val[MAX_TAGS];
+  value_tag branch_target[MAX_TAGS];
+  bool decode_success[MAX_TAGS];
+  bool isstore[MAX_TAGS];
+  branch_type btype[MAX_TAGS];
+  int set_reg[MAX_TAGS];
+  uint32_t predicted_branch[MAX_TAGS];
+  int pc[MAX_TAGS];
+  int rasp[MAX_TAGS];
+  uint64_t history[MAX_TAGS];
+  CommitStall pending_reason[MAX_TAGS];
+  // Entries in use, and those whose val or branch_target is not available.
+  tag_set busy;
+  tag_set pending;
+  // For each tag, the entries whose val or branch_target waits on it.
+  // Bits may be stale; they are filtered by busy and the operand tags.
+  tag_set waiters[MAX_TAGS];
+} rob;
 static int rob_top;
 static int rob_bottom;
 
+inline void rob_dispatch(int i, const rob_val &d) {
+  rob.val[i] = d.val;
+  rob.branch_target[i] = d.branch_target;
+  rob.decode_success[i] = d.decode_success;
+  rob.isstore[i] = d.isstore;
+  rob.btype[i] = d.btype;
+  rob.set_reg[i] = d.set_reg;
+  rob.predicted_branch[i] = d.predicted_branch;
+  rob.pc[i] = d.pc;
+  rob.rasp[i] = d.rasp;
+  rob.history[i] = d.history;
+  rob.pending_reason[i] = d.pending_reason;
+  rob.busy.set(i);
+  rob.pending.reset(i);
+  if(!d.val.available) {
+    rob.waiters[d.val.tag].set(i);
+    rob.pending.set(i);
+  }
+  if(!d.branch_target.available) {
+    rob.waiters[d.branch_target.tag].set(i);
+    rob.pending.set(i);
+  }
+}
+
+// Wakes the entries waiting on the tags broadcast in this cycle.
+inline void rob_wakeup() {
+  cdb_tags.for_each([](int tag) {
+    rob.waiters[tag].for_each([](int i) {
+      if(!rob.busy.test(i)) return;
+      rob.val[i] = snoop(rob.val[i]);
+      rob.branch_target[i] = snoop(rob.branch_target[i]);
+      if(rob.val[i].available && rob.branch_target[i].available) {
+        rob.pending.reset(i);
+      }
+    });
+    rob.waiters[tag].clear();
+  });
+}
+
+inline void rob_reset() {
+  rob.busy.clear();
+  rob.pending.clear();
+  rob_top = 0;
+  rob_bottom = 0;
+}
+
 value_tag reg[NUM_REGS];
 
 inline value_tag get_reg(int r) {
   value_tag rv = reg[r];
   if(rv.available) return rv;
-  if(rob[rv.tag].val.available) return rob[rv.tag].val;
+  if(rob.val[rv.tag].available) return rob.val[rv.tag];
   return snoop(rv);
 }
 
-static uint32_t ra_stack[32];
+static uint32_t ra_stack[max_ras_depth];
+static int ras_depth;
 static int rasp;
 
+static string predictor_name;
+static unique_ptr<branch_predictor> predictor;
+static unique_ptr<branch_target_buffer> btb;
+// Outcomes of the conditional branches fetched so far, masked to what the
+// predictor uses. Checkpointed in the ROB like rasp.
+static uint64_t branch_history;
+static uint64_t branch_history_mask;
+// With -t, every kind of predictor is also trained at commit on the
+// committed history, to compare their accuracy on the same run.
+static vector<unique_ptr<branch_predictor>> shadow_predictors;
+static vector<uint64_t> shadow_missed_branches;
+// Masked to bp_history_length whatever predictor is selected.
+static uint64_t shadow_history;
+static uint64_t shadow_history_mask;
+
+inline bool is_return(uint32_t pword) {
+  return pword>>26 == OPCODE_SPECIAL && (pword&63) == FUNCT_JR &&
+    ((pword>>21)&31) == 31;
+}
+
 static uint64_t num_cycles;
 static uint64_t num_instructions;
 
@@ -455,27 +1224,460 @@ static uint64_t num_committed_branches;
 static uint64_t num_missed_branches;
 static uint64_t num_committed_jumpregisters;
 static uint64_t num_missed_jumpregisters;
+static uint64_t num_btb_lookups;
+static uint64_t num_btb_hits;
+
+timeval start_tv;
+
+enum class StallReason : int {
+  NO_STALL = 0,
+  INSTRUCTION_UNAVAILABLE = 1,
+  ROB_UNAVAILABLE = 2,
+  MEM_UNAVAILABLE = 3,
+  BRANCHER_UNAVAILABLE = 4,
+  ALU_UNAVAILABLE = 5,
+  FADD_UNAVAILABLE = 6,
+  FMUL_UNAVAILABLE = 7,
+  FCMP_UNAVAILABLE = 8,
+  FOTHERS_UNAVAILABLE = 9,
+};
+const int NumStallReasons = 10;
+const char *const stall_reason_names[NumStallReasons] = {
+  "No stall",
+  "Instruction unavailable",
+  "ROB unavailable",
+  "Load/Store Buffer unavailable",
+  "Brancher unavailable",
+  "ALU unavailable",
+  "FP Adder unavailable",
+  "FP Multiplier unavailable",
+  "FP Comparator unavailable",
+  "FP Div/Sqrt/Ftoi/Itof unavailable",
+};
+
+// Why dispatch stopped, for cycles that dispatched nothing or the full
+// width, and for cycles that dispatched only part of it.
+static uint64_t stall_reason_counts[NumStallReasons];
+static uint64_t partial_stall_reason_counts[NumStallReasons];
+static int dispatch_width;
+static int commit_width;
+const char *const commit_stall_names[NumCommitStalls] = {
+  "Committing",
+  "Front end (ROB empty)",
+  "Refetch after misprediction or replay (ROB empty)",
+  "Load",
+  "Store waiting for the memory stage",
+  "Branch resolution",
+  "ALU",
+  "FP Adder",
+  "FP Multiplier",
+  "FP Comparator",
+  "FP Div/Sqrt/Ftoi/Itof",
+};
+// Cycles by what the commit stage did, which sum to num_cycles.
+static uint64_t commit_stall_counts[NumCommitStalls];
+// For -t: cycles by the number of busy entries of each structure, or of
+// results on the CDB, and the capacity of each.
+const int num_occupancy_structures = 10;
+const char *const occupancy_names[num_occupancy_structures] = {
+  "ROB",
+  "Load/Store Buffer (address)",
+  "Load/Store Buffer (memory)",
+  "Brancher",
+  "ALU",
+  "FP Adder",
+  "FP Multiplier",
+  "FP Comparator",
+  "FP Div/Sqrt/Ftoi/Itof",
+  "CDB",
+};
+const int max_occupancy = max_rob_size;
+static_assert(max_unit_entries <= max_occupancy &&
+              MAX_CDB_SIZE <= max_occupancy, "max_occupancy is too small");
+static uint64_t occupancy_counts[num_occupancy_structures][max_occupancy+1];
+static int occupancy_capacity[num_occupancy_structures];
+// Cycles by the number of instructions dispatched and committed.
+static uint64_t dispatch_width_counts[max_pipeline_width+1];
+static uint64_t commit_width_counts[max_pipeline_width+1];
+
+// Instructions are fetched from the first num_fetchable_pcs words only.
+const int num_fetchable_pcs = 1<<15;
+
+// Per-pc counts for -t and --pc-stats, indexed by pc*num_pc_events+event.
+// The events are the dispatch stalls by StallReason, charged to the
+// instruction that could not dispatch, the cycles the ROB head could not
+// commit, and the mispredictions by branch pc.
+const int pc_commit_stall = NumStallReasons;
+const int pc_branch_miss = NumStallReasons+1;
+const int pc_jr_miss = NumStallReasons+2;
+const int num_pc_events = NumStallReasons+3;
+static vector<uint64_t> pc_event_counts;
+// For --skip-idle, the indices counted while idle snapshots are kept, so
+// that the counts of a period can be repeated. Like the cache journals, it
+// is incomplete once longer than cache::max_journal_size.
+static vector<uint32_t> pc_event_journal;
+static bool record_pc_event_journal;
+
+inline void count_pc_event(int pc, int event) {
+  if(pc_event_counts.empty() || pc < 0 || pc >= num_fetchable_pcs) return;
+  uint32_t i = (uint32_t)pc*num_pc_events + event;
+  ++pc_event_counts[i];
+  if(record_pc_event_journal &&
+     pc_event_journal.size() <= cache::max_journal_size) {
+    pc_event_journal.push_back(i);
+  }
+}
+
+// An instruction in the fetch or decode latch, with the prediction made
+// when it was fetched.
+struct fetch_entry {
+  uint32_t pword;
+  int pc;
+  uint32_t predicted_branch;
+  int rasp;
+  uint64_t history;
+  int trace_id;
+};
+
+inline void save_fetch_entry(state_buffer &state, const fetch_entry &f) {
+  state.put(f.pword);
+  state.put(f.pc);
+  state.put(f.predicted_branch);
+  state.put(f.rasp);
+  state.put64(f.history);
+}
+
+// Where cas_run_program() writes the statistics when the program halts.
+static string cas_result_file;
+
+const uint64_t cycles_per_report = 100000000;
+
+// For --interval-out: the file, the cycle the current interval ends at,
+// and the counters at its start.
+static FILE *interval_fp;
+static uint64_t next_interval_cycle;
+static struct {
+  uint64_t num_cycles;
+  uint64_t num_instructions;
+  uint64_t num_committed_branches;
+  uint64_t num_missed_branches;
+  uint64_t num_committed_jumpregisters;
+  uint64_t num_missed_jumpregisters;
+  uint64_t stall_reason_counts[NumStallReasons];
+} interval_start;
+
+static void start_interval() {
+  interval_start.num_cycles = num_cycles;
+  interval_start.num_instructions = num_instructions;
+  interval_start.num_committed_branches = num_committed_branches;
+  interval_start.num_missed_branches = num_missed_branches;
+  interval_start.num_committed_jumpregisters = num_committed_jumpregisters;
+  interval_start.num_missed_jumpregisters = num_missed_jumpregisters;
+  copy(stall_reason_counts, stall_reason_counts+NumStallReasons,
+       interval_start.stall_reason_counts);
+  next_interval_cycle = num_cycles + interval_length;
+}
+
+static void open_interval_file() {
+  next_interval_cycle = UINT64_MAX;
+  if(interval_file.empty()) return;
+  interval_fp = fopen(interval_file.c_str(), "w");
+  if(!interval_fp) {
+    fprintf(stderr, "error: cannot open %s\n", interval_file.c_str());
+    exit(1);
+  }
+  fprintf(interval_fp,
+      "cycle,cycles,instructions,ipc,branches,branch_misses,jrs,jr_misses,"
+      "stall_instruction,stall_rob,stall_lsbuffer,stall_brancher,stall_alu,"
+      "stall_fp_adder,stall_fp_multiplier,stall_fp_comparator,"
+      "stall_fp_others\n");
+  start_interval();
+}
+
+// Appends the deltas of the counters since the start of the interval,
+// which ends at the current cycle.
+static void write_interval_row() {
+  uint64_t cycles = num_cycles - interval_start.num_cycles;
+  uint64_t instructions = num_instructions - interval_start.num_instructions;
+  fprintf(interval_fp,
+      "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f,"
+      "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+      num_cycles, cycles, instructions, (double)instructions/cycles,
+      num_committed_branches - interval_start.num_committed_branches,
+      num_missed_branches - interval_start.num_missed_branches,
+      num_committed_jumpregisters -
+      interval_start.num_committed_jumpregisters,
+      num_missed_jumpregisters - interval_start.num_missed_jumpregisters);
+  for(int i = 1; i < NumStallReasons; ++i) {
+    fprintf(interval_fp, ",%" PRIu64,
+        stall_reason_counts[i] - interval_start.stall_reason_counts[i]);
+  }
+  fprintf(interval_fp, "\n");
+  fflush(interval_fp);
+  start_interval();
+}
+
+// For --skip-idle: the machine state and counters at a poll of a port that
+// was not ready.
+struct idle_snapshot {
+  state_buffer state;
+  uint64_t hash;
+  uint64_t num_cycles;
+  uint64_t num_instructions;
+  uint64_t num_committed_branches;
+  uint64_t num_missed_branches;
+  uint64_t num_committed_jumpregisters;
+  uint64_t num_missed_jumpregisters;
+  uint64_t num_btb_lookups;
+  uint64_t num_btb_hits;
+  uint64_t num_performed_loads;
+  uint64_t num_forwarded_loads;
+  uint64_t num_speculative_loads;
+  uint64_t num_memory_order_violations;
+  vector<uint64_t> shadow_missed_branches;
+  uint64_t icache_accesses;
+  uint64_t icache_misses;
+  size_t icache_journal_size;
+  uint64_t dcache_accesses;
+  uint64_t dcache_misses;
+  size_t dcache_journal_size;
+  size_t pc_event_journal_size;
+  uint64_t stall_reason_counts[NumStallReasons];
+  uint64_t partial_stall_reason_counts[NumStallReasons];
+  uint64_t dispatch_width_counts[max_pipeline_width+1];
+  uint64_t commit_width_counts[max_pipeline_width+1];
+  uint64_t commit_stall_counts[NumCommitStalls];
+  uint64_t occupancy_counts[num_occupancy_structures][max_occupancy+1];
+};
+// ROB tags rotate, so a polling loop returns to the same state only after
+// several iterations.
+static const int max_idle_snapshots = 64;
+static vector<idle_snapshot> idle_snapshots;
+static uint64_t idle_snapshots_rs_events;
+
+// The journals are recorded only while there are snapshots to repeat them
+// from, so that a long stretch without polling does not grow them.
+static void record_journals(bool on) {
+  icache->record_journal = on;
+  dcache->record_journal = on;
+  record_pc_event_journal = on;
+}
+
+static void clear_idle_snapshots() {
+  idle_snapshots.clear();
+  icache->journal.clear();
+  dcache->journal.clear();
+  pc_event_journal.clear();
+  record_journals(false);
+}
+
+// When the machine is in the same state as at an earlier poll and no
+// RS-232C event happened since, it is polling with a fixed period and will
+// keep doing so until the next event. Jumps over as many whole periods as
+// fit before that event, which gives the same cycle counts as stepping.
+static void skip_idle_periods(idle_snapshot &snapshot) {
+  if(idle_snapshots_rs_events != rs_num_events ||
+     icache->journal.size() > cache::max_journal_size ||
+     dcache->journal.size() > cache::max_journal_size ||
+     pc_event_journal.size() > cache::max_journal_size) {
+    clear_idle_snapshots();
+    idle_snapshots_rs_events = rs_num_events;
+  }
+  for(const idle_snapshot &past : idle_snapshots) {
+    if(past.hash != snapshot.hash ||
+       past.state.words != snapshot.state.words) {
+      continue;
+    }
+    uint64_t period = num_cycles - past.num_cycles;
+    // Stop before the next progress report and the next RS-232C event.
+    uint64_t limit = cycles_per_report - num_cycles % cycles_per_report - 1;
+    if(!recv_eof) {
+      limit = min(limit, (uint64_t)recv_count);
+    }
+    if(send_queue_bottom != send_queue_top) {
+      limit = min(limit, (uint64_t)send_count);
+    }
+    // Stop before the end of the interval and the trace window.
+    limit = min(limit, next_interval_cycle - num_cycles - 1);
+    if(trace && num_cycles < trace_from) {
+      limit = min(limit, trace_from - num_cycles - 1);
+    }
+    uint64_t num_periods = limit / period;
+    if(num_periods == 0) return;
+    uint64_t skip = num_periods * period;
+    num_cycles += skip;
+    num_instructions +=
+      num_periods * (num_instructions - past.num_instructions);
+    num_committed_branches +=
+      num_periods * (num_committed_branches - past.num_committed_branches);
+    num_missed_branches +=
+      num_periods * (num_missed_branches - past.num_missed_branches);
+    num_committed_jumpregisters +=
+      num_periods *
+      (num_committed_jumpregisters - past.num_committed_jumpregisters);
+    num_missed_jumpregisters +=
+      num_periods * (num_missed_jumpregisters - past.num_missed_jumpregisters);
+    num_btb_lookups += num_periods * (num_btb_lookups - past.num_btb_lookups);
+    num_btb_hits += num_periods * (num_btb_hits - past.num_btb_hits);
+    num_performed_loads +=
+      num_periods * (num_performed_loads - past.num_performed_loads);
+    num_forwarded_loads +=
+      num_periods * (num_forwarded_loads - past.num_forwarded_loads);
+    num_speculative_loads +=
+      num_periods * (num_speculative_loads - past.num_speculative_loads);
+    num_memory_order_violations += num_periods *
+      (num_memory_order_violations - past.num_memory_order_violations);
+    for(size_t i = 0; i < shadow_missed_branches.size(); ++i) {
+      shadow_missed_branches[i] += num_periods *
+        (shadow_missed_branches[i] - past.shadow_missed_branches[i]);
+    }
+    icache->num_accesses +=
+      num_periods * (icache->num_accesses - past.icache_accesses);
+    icache->num_misses +=
+      num_periods * (icache->num_misses - past.icache_misses);
+    icache->repeat_journal(past.icache_journal_size, num_periods);
+    dcache->num_accesses +=
+      num_periods * (dcache->num_accesses - past.dcache_accesses);
+    dcache->num_misses +=
+      num_periods * (dcache->num_misses - past.dcache_misses);
+    dcache->repeat_journal(past.dcache_journal_size, num_periods);
+    for(size_t i = past.pc_event_journal_size; i < pc_event_journal.size();
+        ++i) {
+      pc_event_counts[pc_event_journal[i]] += num_periods;
+    }
+    for(int i = 0; i < NumStallReasons; ++i) {
+      stall_reason_counts[i] +=
+        num_periods * (stall_reason_counts[i] - past.stall_reason_counts[i]);
+      partial_stall_reason_counts[i] += num_periods *
+        (partial_stall_reason_counts[i] -
+         past.partial_stall_reason_counts[i]);
+    }
+    for(int i = 0; i < NumCommitStalls; ++i) {
+      commit_stall_counts[i] +=
+        num_periods * (commit_stall_counts[i] - past.commit_stall_counts[i]);
+    }
+    if(show_statistics) {
+      for(int i = 0; i < num_occupancy_structures; ++i) {
+        for(int j = 0; j <= occupancy_capacity[i]; ++j) {
+          occupancy_counts[i][j] += num_periods *
+            (occupancy_counts[i][j] - past.occupancy_counts[i][j]);
+        }
+      }
+    }
+    for(int i = 0; i <= max_pipeline_width; ++i) {
+      dispatch_width_counts[i] += num_periods *
+        (dispatch_width_counts[i] - past.dispatch_width_counts[i]);
+      commit_width_counts[i] += num_periods *
+        (commit_width_counts[i] - past.commit_width_counts[i]);
+    }
+    if(!recv_eof) recv_count -= skip;
+    send_count = (uint64_t)send_count > skip ? send_count - skip : 0;
+    clear_idle_snapshots();
+    return;
+  }
+  if((int)idle_snapshots.size() >= max_idle_snapshots) {
+    idle_snapshots.erase(idle_snapshots.begin());
+  }
+  record_journals(true);
+  snapshot.num_cycles = num_cycles;
+  snapshot.num_instructions = num_instructions;
+  snapshot.num_committed_branches = num_committed_branches;
+  snapshot.num_missed_branches = num_missed_branches;
+  snapshot.num_committed_jumpregisters = num_committed_jumpregisters;
+  snapshot.num_missed_jumpregisters = num_missed_jumpregisters;
+  snapshot.num_btb_lookups = num_btb_lookups;
+  snapshot.num_btb_hits = num_btb_hits;
+  snapshot.num_performed_loads = num_performed_loads;
+  snapshot.num_forwarded_loads = num_forwarded_loads;
+  snapshot.num_speculative_loads = num_speculative_loads;
+  snapshot.num_memory_order_violations = num_memory_order_violations;
+  snapshot.shadow_missed_branches = shadow_missed_branches;
+  snapshot.icache_accesses = icache->num_accesses;
+  snapshot.icache_misses = icache->num_misses;
+  snapshot.icache_journal_size = icache->journal.size();
+  snapshot.dcache_accesses = dcache->num_accesses;
+  snapshot.dcache_misses = dcache->num_misses;
+  snapshot.dcache_journal_size = dcache->journal.size();
+  snapshot.pc_event_journal_size = pc_event_journal.size();
+  copy(stall_reason_counts, stall_reason_counts+NumStallReasons,
+       snapshot.stall_reason_counts);
+  copy(partial_stall_reason_counts,
+       partial_stall_reason_counts+NumStallReasons,
+       snapshot.partial_stall_reason_counts);
+  copy(dispatch_width_counts, dispatch_width_counts+max_pipeline_width+1,
+       snapshot.dispatch_width_counts);
+  copy(commit_width_counts, commit_width_counts+max_pipeline_width+1,
+       snapshot.commit_width_counts);
+  copy(commit_stall_counts, commit_stall_counts+NumCommitStalls,
+       snapshot.commit_stall_counts);
+  if(show_statistics) {
+    copy(&occupancy_counts[0][0],
+         &occupancy_counts[0][0] +
+         num_occupancy_structures*(max_occupancy+1),
+         &snapshot.occupancy_counts[0][0]);
+  }
+  idle_snapshots.push_back(snapshot);
+}
 
-timeval start_tv;
 
-enum class StallReason : int {
-  NO_STALL = 0,
-  INSTRUCTION_UNAVAILABLE = 1,
-  ROB_UNAVAILABLE = 2,
-  MEM_UNAVAILABLE = 3,
-  BRANCHER_UNAVAILABLE = 4,
-  ALU_UNAVAILABLE = 5,
-  FADD_UNAVAILABLE = 6,
-  FMUL_UNAVAILABLE = 7,
-  FCMP_UNAVAILABLE = 8,
-  FOTHERS_UNAVAILABLE = 9,
+// The functional units of a machine. Units with parameters fixed at
+// compile time are specialized by the compiler; runtime_machine accepts
+// any configuration.
+struct default_machine {
+  typedef load_store_buffer<2, 2, 1> lsbuffer_type;
+  typedef reservation_station<1, 2, 1, branch_unit> brancher_type;
+  typedef reservation_station<1, 2, 1, alu_unit> alu_type;
+  typedef reservation_station<2, 2, 1, fp_adder_unit> fp_adder_type;
+  typedef reservation_station<2, 2, 1, fp_multiplier_unit>
+    fp_multiplier_type;
+  typedef reservation_station<1, 2, 1, fp_comparator_unit>
+    fp_comparator_type;
+  typedef reservation_station<7, 2, 1, fp_others_unit> fp_others_type;
+};
+struct runtime_machine {
+  typedef load_store_buffer<runtime_param, runtime_param, runtime_param>
+    lsbuffer_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              branch_unit> brancher_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              alu_unit> alu_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              fp_adder_unit> fp_adder_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              fp_multiplier_unit> fp_multiplier_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              fp_comparator_unit> fp_comparator_type;
+  typedef reservation_station<runtime_param, runtime_param, runtime_param,
+                              fp_others_unit> fp_others_type;
 };
-const int NumStallReasons = 10;
-
-static uint64_t stall_reason_counts[NumStallReasons];
 
+template<typename machine>
+static bool machine_accepts(const cas_config &config) {
+  return
+    machine::lsbuffer_type::accepts(
+        config.lsbuffer_address_entries, config.lsbuffer_memory_entries,
+        config.lsbuffer_ports) &&
+    machine::brancher_type::accepts(
+        config.brancher_latency, config.brancher_entries,
+        config.brancher_ports) &&
+    machine::alu_type::accepts(
+        config.alu_latency, config.alu_entries, config.alu_ports) &&
+    machine::fp_adder_type::accepts(
+        config.fp_adder_latency, config.fp_adder_entries,
+        config.fp_adder_ports) &&
+    machine::fp_multiplier_type::accepts(
+        config.fp_multiplier_latency, config.fp_multiplier_entries,
+        config.fp_multiplier_ports) &&
+    machine::fp_comparator_type::accepts(
+        config.fp_comparator_latency, config.fp_comparator_entries,
+        config.fp_comparator_ports) &&
+    machine::fp_others_type::accepts(
+        config.fp_others_latency, config.fp_others_entries,
+        config.fp_others_ports);
+}
 
-static void cas_run() {
+template<typename machine>
+static void cas_run(const cas_config &config) {
   num_cycles = 0;
   num_instructions = 0;
   num_committed_branches = 0;
@@ -484,151 +1686,74 @@ static void cas_run() {
   num_missed_jumpregisters = 0;
   gettimeofday(&start_tv, nullptr);
   fill(stall_reason_counts,stall_reason_counts+NumStallReasons,0);
+  fill(partial_stall_reason_counts,
+       partial_stall_reason_counts+NumStallReasons, 0);
+  fill(dispatch_width_counts, dispatch_width_counts+max_pipeline_width+1, 0);
+  fill(commit_width_counts, commit_width_counts+max_pipeline_width+1, 0);
+  fill(commit_stall_counts, commit_stall_counts+NumCommitStalls, 0);
+  fill(&occupancy_counts[0][0],
+       &occupancy_counts[0][0] + num_occupancy_structures*(max_occupancy+1),
+       0);
+  const int fetch_width = config.fetch_width;
+  dispatch_width = config.dispatch_width;
+  commit_width = config.commit_width;
+  store_forwarding = config.store_forwarding;
+  speculative_loads = config.speculative_loads;
 
   int pc = 0;
-  uint32_t fetched_instruction = 0x55555555U;
-  uint32_t decoded_instruction = 0x55555555U;
-  int fetched_instruction_pc = -1;
-  int decoded_instruction_pc = -1;
-  uint32_t fetched_instruction_predicted_branch = 0x55555555U;
-  uint32_t decoded_instruction_predicted_branch = 0x55555555U;
-  bool fetched_instruction_available = false;
-  bool decoded_instruction_available = false;
-  int fetched_instruction_rasp = -1;
-  int decoded_instruction_rasp = -1;
+  // The fetch group, and the part of the decoded group not yet dispatched.
+  // A group moves on only when the next latch is empty.
+  fetch_entry fetched[max_pipeline_width];
+  int num_fetched = 0;
+  fetch_entry decoded[max_pipeline_width];
+  int decoded_head = 0;
+  int num_decoded = 0;
+  // Set from a misprediction until an instruction on the right path is
+  // dispatched.
+  bool recovering = false;
 
   rasp = 0;
+  icache_pc = -1;
+  icache_wait = 0;
+
+  fill(trace_ids, trace_ids+MAX_TAGS, -1);
 
   reset_cdb();
+  cdb_width = config.cdb_width;
+  cdb_cycle = 0;
+  reset_cdb_reservations();
   for(int i = 0; i < NUM_REGS; ++i) {
     reg[i] = from_value(0);
   }
 
   rs_init();
 
-  load_store_buffer<2, 2> lsbuffer;
-  reservation_station<1, 2, 4> brancher;
-  reservation_station<1, 2, 2> alu;
-  reservation_station<2, 2, 2> fp_adder;
-  reservation_station<2, 2, 2> fp_multiplier;
-  reservation_station<1, 2, 2> fp_comparator;
-  reservation_station<7, 2, 2> fp_others;
-  brancher.fun = [](const rs_entry<4> &e) -> uint32_t {
-    if((e.opcode&1) ^ (e.operands[0].value == e.operands[1].value)) {
-      return e.operands[3].value;
-    } else {
-      return e.operands[2].value;
-    }
-  };
-  alu.fun = [](const rs_entry<2> &e) -> uint32_t {
-    switch(e.opcode) {
-      case ALU_OP_ADDU:
-        return e.operands[0].value + e.operands[1].value;
-      case ALU_OP_SUBU:
-        return e.operands[0].value - e.operands[1].value;
-      case ALU_OP_AND:
-        return e.operands[0].value & e.operands[1].value;
-      case ALU_OP_OR:
-        return e.operands[0].value | e.operands[1].value;
-      case ALU_OP_XOR:
-        return e.operands[0].value ^ e.operands[1].value;
-      case ALU_OP_NOR:
-        return ~(e.operands[0].value | e.operands[1].value);
-      case ALU_OP_SLT:
-        return (int32_t)e.operands[0].value < (int32_t)e.operands[1].value;
-      case ALU_OP_SLTU:
-        return e.operands[0].value < e.operands[1].value;
-      case ALU_OP_SLL:
-        return e.operands[1].value << (e.operands[0].value&31);
-      case ALU_OP_SRL:
-        return e.operands[1].value >> (e.operands[0].value&31);
-      case ALU_OP_SRA:
-        return (int32_t)e.operands[1].value >> (e.operands[0].value&31);
-      default:
-        fprintf(stderr, "error: unknown ALU opcode %d\n", e.opcode);
-        show_statistics_and_exit(1);
-        return 0;
-    }
-  };
-  fp_adder.fun = [](const rs_entry<2> &e) -> uint32_t {
-    switch(e.opcode) {
-      case 0:
-        if(use_native_fp)
-          return native_fadd(e.operands[0].value, e.operands[1].value);
-        else
-          return fadd(e.operands[0].value, e.operands[1].value);
-      case 1:
-        if(use_native_fp)
-          return native_fsub(e.operands[0].value, e.operands[1].value);
-        else
-          return fsub(e.operands[0].value, e.operands[1].value);
-      case 2:
-        return e.operands[0].value;
-      case 3:
-        return e.operands[0].value ^ 0x80000000U;
-      default:
-        fprintf(stderr, "error: unknown fp_adder opcode %d\n", e.opcode);
-        show_statistics_and_exit(1);
-        return 0;
-    }
-  };
-  fp_multiplier.fun = [](const rs_entry<2> &e) -> uint32_t {
-    if(use_native_fp)
-      return native_fmul(e.operands[0].value, e.operands[1].value);
-    else
-      return fmul(e.operands[0].value, e.operands[1].value);
-  };
-  fp_comparator.fun = [](const rs_entry<2> &e) -> uint32_t {
-    switch(e.opcode) {
-      case 2:
-        if(use_native_fp)
-          return native_feq(e.operands[0].value, e.operands[1].value);
-        else
-          return feq(e.operands[0].value, e.operands[1].value);
-      case 4:
-        if(use_native_fp)
-          return native_flt(e.operands[0].value, e.operands[1].value);
-        else
-          return flt(e.operands[0].value, e.operands[1].value);
-      case 6:
-        if(use_native_fp)
-          return native_fle(e.operands[0].value, e.operands[1].value);
-        else
-          return fle(e.operands[0].value, e.operands[1].value);
-      default:
-        fprintf(stderr, "error: unknown fp_comparator opcode %d\n", e.opcode);
-        show_statistics_and_exit(1);
-        return 0;
-    }
-  };
-  fp_others.fun = [](const rs_entry<2> &e) -> uint32_t {
-    switch(e.opcode) {
-      case 0:
-        if(use_native_fp)
-          return native_fdiv(e.operands[0].value, e.operands[1].value);
-        else
-          return fdiv(e.operands[0].value, e.operands[1].value);
-      case 1:
-        if(use_native_fp)
-          return native_fsqrt(e.operands[0].value);
-        else
-          return fsqrt(e.operands[0].value);
-      case 2:
-        if(use_native_fp)
-          return native_itof(e.operands[0].value);
-        else
-          return itof(e.operands[0].value);
-      case 3:
-        if(use_native_fp)
-          return native_ftoi(e.operands[0].value);
-        else
-          return ftoi(e.operands[0].value);
-      default:
-        fprintf(stderr, "error: unknown fp_others opcode %d\n", e.opcode);
-        show_statistics_and_exit(1);
-        return 0;
-    }
-  };
+  typename machine::lsbuffer_type lsbuffer;
+  typename machine::brancher_type brancher;
+  typename machine::alu_type alu;
+  typename machine::fp_adder_type fp_adder;
+  typename machine::fp_multiplier_type fp_multiplier;
+  typename machine::fp_comparator_type fp_comparator;
+  typename machine::fp_others_type fp_others;
+  lsbuffer.configure(
+      config.lsbuffer_address_entries, config.lsbuffer_memory_entries,
+      config.lsbuffer_ports, store_forwarding, speculative_loads);
+  brancher.configure(
+      config.brancher_latency, config.brancher_entries,
+      config.brancher_ports);
+  alu.configure(config.alu_latency, config.alu_entries, config.alu_ports);
+  fp_adder.configure(
+      config.fp_adder_latency, config.fp_adder_entries,
+      config.fp_adder_ports);
+  fp_multiplier.configure(
+      config.fp_multiplier_latency, config.fp_multiplier_entries,
+      config.fp_multiplier_ports);
+  fp_comparator.configure(
+      config.fp_comparator_latency, config.fp_comparator_entries,
+      config.fp_comparator_ports);
+  fp_others.configure(
+      config.fp_others_latency, config.fp_others_entries,
+      config.fp_others_ports);
   lsbuffer.reset();
   brancher.reset();
   alu.reset();
@@ -636,114 +1761,190 @@ static void cas_run() {
   fp_multiplier.reset();
   fp_comparator.reset();
   fp_others.reset();
+  {
+    int capacity[num_occupancy_structures] = {
+      num_tags,
+      lsbuffer.num_entries1(), lsbuffer.num_entries2(),
+      brancher.num_entries(), alu.num_entries(), fp_adder.num_entries(),
+      fp_multiplier.num_entries(), fp_comparator.num_entries(),
+      fp_others.num_entries(),
+      cdb_width ? cdb_width :
+      lsbuffer.num_ports() + brancher.num_ports() + alu.num_ports() +
+      fp_adder.num_ports() + fp_multiplier.num_ports() +
+      fp_comparator.num_ports() + fp_others.num_ports(),
+    };
+    copy(capacity, capacity+num_occupancy_structures, occupancy_capacity);
+  }
 
-  rob_top = 0;
-  rob_bottom = 0;
+  rob_reset();
+  for(int i = 0; i < num_tags; ++i) {
+    rob.waiters[i].clear();
+  }
+
+  clear_idle_snapshots();
+  idle_snapshots_rs_events = 0;
+  open_interval_file();
 
   for(;;) {
+    if(trace) trace->set_cycle(num_cycles);
     rs_cycle();
     int last_rob_top = rob_top;
-    uint32_t last_rob_val = rob[rob_top].val.value;
     bool refetch = false;
     int refetch_address = -1;
     int refetch_rasp = -1;
-    if(rob[rob_top].busy && !rob[rob_top].decode_success) {
-      fprintf(stderr, "error: tried to commit undecoded instruction\n");
-      show_statistics_and_exit(1);
-    }
-    bool rob_top_committable =
-      rob[rob_top].busy &&
-      rob[rob_top].val.available &&
-      rob[rob_top].branch_target.available;
-    if(rob_top_committable &&
-       (!rob[rob_top].isstore ||
-        lsbuffer.store_committable(rob_top, rob_top_committable)) ) {
-      if(rob[rob_top].set_reg) {
+    uint64_t refetch_history = 0;
+    // Commits in order up to commit_width instructions. A misprediction or
+    // a store ends the group, as the memory stage writes one store per
+    // cycle.
+    int committed_store = -1;
+    uint32_t committed_store_value = 0;
+    int num_committed = 0;
+    while(num_committed < commit_width) {
+      if(rob.busy.test(rob_top) && !rob.decode_success[rob_top]) {
+        fprintf(stderr, "error: tried to commit undecoded instruction\n");
+        show_statistics_and_exit(1);
+      }
+      if(rob.busy.test(rob_top) && lsbuffer.violated.test(rob_top)) {
+        // Replays the load from its own fetch.
+        num_memory_order_violations++;
+        refetch = true;
+        refetch_address = rob.pc[rob_top];
+        refetch_rasp = rob.rasp[rob_top];
+        refetch_history = rob.history[rob_top];
+        break;
+      }
+      if(!rob.busy.test(rob_top) || rob.pending.test(rob_top)) break;
+      if(rob.isstore[rob_top]) {
+        if(!lsbuffer.store_committable(rob_top)) break;
+        committed_store = rob_top;
+        committed_store_value = rob.val[rob_top].value;
+      }
+      if(rob.set_reg[rob_top]) {
         if(show_commit_log) {
           fprintf(stderr, "pc=0x%08x: $%s <- 0x%08x\n",
-              (uint32_t)rob[rob_top].pc*4,
-              regnames[rob[rob_top].set_reg], rob[rob_top].val.value);
+              (uint32_t)rob.pc[rob_top]*4,
+              regnames[rob.set_reg[rob_top]], rob.val[rob_top].value);
         }
-        reg[rob[rob_top].set_reg].value = rob[rob_top].val.value;
-        reg[rob[rob_top].set_reg].available =
-          reg[rob[rob_top].set_reg].tag == rob_top;
+        reg[rob.set_reg[rob_top]].value = rob.val[rob_top].value;
+        reg[rob.set_reg[rob_top]].available =
+          reg[rob.set_reg[rob_top]].tag == rob_top;
       }
       refetch =
-        rob[rob_top].branch_target.value != rob[rob_top].predicted_branch;
-      if(rob[rob_top].btype == branch_type::JUMP) {
+        rob.branch_target[rob_top].value != rob.predicted_branch[rob_top];
+      if(rob.btype[rob_top] == branch_type::JUMP) {
         if(show_commit_log) {
           fprintf(stderr, "pc=0x%08x: jump to 0x%08x\n",
-              (uint32_t)rob[rob_top].pc*4,
-              rob[rob_top].branch_target.value);
+              (uint32_t)rob.pc[rob_top]*4,
+              rob.branch_target[rob_top].value);
         }
-      } else if(rob[rob_top].btype == branch_type::JUMPREGISTER) {
+      } else if(rob.btype[rob_top] == branch_type::JUMPREGISTER) {
         num_committed_jumpregisters++;
-        if(refetch) num_missed_jumpregisters++;
+        if(refetch) {
+          num_missed_jumpregisters++;
+          count_pc_event(rob.pc[rob_top], pc_jr_miss);
+        }
+        if(btb->enabled() && !is_return(ram[rob.pc[rob_top]])) {
+          btb->update(rob.pc[rob_top],
+                      rob.branch_target[rob_top].value>>2);
+        }
         if(show_commit_log) {
           fprintf(stderr, "pc=0x%08x: jump register to 0x%08x\n",
-              (uint32_t)rob[rob_top].pc*4,
-              rob[rob_top].branch_target.value);
+              (uint32_t)rob.pc[rob_top]*4,
+              rob.branch_target[rob_top].value);
           if(refetch) {
             fprintf(stderr, "pc=0x%08x: jump-target prediction missed\n",
-                (uint32_t)rob[rob_top].pc*4);
+                (uint32_t)rob.pc[rob_top]*4);
           }
         }
-      } else if(rob[rob_top].btype == branch_type::BRANCH) {
+      } else if(rob.btype[rob_top] == branch_type::BRANCH) {
         num_committed_branches++;
-        if(refetch) num_missed_branches++;
+        int branch_pc = rob.pc[rob_top];
+        if(refetch) {
+          num_missed_branches++;
+          count_pc_event(branch_pc, pc_branch_miss);
+        }
+        int taken_target = branch_pc+1+(int16_t)ram[branch_pc];
+        bool taken =
+          rob.branch_target[rob_top].value != (uint32_t)(branch_pc+1)*4;
+        predictor->update(branch_pc, taken_target, rob.history[rob_top],
+                          taken);
+        refetch_history =
+          ((rob.history[rob_top]<<1) | taken) & branch_history_mask;
+        for(size_t i = 0; i < shadow_predictors.size(); ++i) {
+          branch_predictor &shadow = *shadow_predictors[i];
+          if(shadow.predict(branch_pc, taken_target, shadow_history) !=
+             taken) {
+            shadow_missed_branches[i]++;
+          }
+          shadow.update(branch_pc, taken_target, shadow_history, taken);
+        }
+        shadow_history = ((shadow_history<<1) | taken) & shadow_history_mask;
         if(show_commit_log) {
-          if(rob[rob_top].branch_target.value ==
-              (uint32_t)(rob[rob_top].pc+1)*4) {
+          if(rob.branch_target[rob_top].value ==
+              (uint32_t)(rob.pc[rob_top]+1)*4) {
             fprintf(stderr, "pc=0x%08x: branch not taken\n",
-                (uint32_t)rob[rob_top].pc*4);
+                (uint32_t)rob.pc[rob_top]*4);
           } else {
             fprintf(stderr, "pc=0x%08x: branch taken to 0x%08x\n",
-                (uint32_t)rob[rob_top].pc*4,
-                rob[rob_top].branch_target.value);
+                (uint32_t)rob.pc[rob_top]*4,
+                rob.branch_target[rob_top].value);
           }
           if(refetch) {
             fprintf(stderr, "pc=0x%08x: branch prediction missed\n",
-                (uint32_t)rob[rob_top].pc*4);
+                (uint32_t)rob.pc[rob_top]*4);
           }
         }
       }
       if(refetch) {
-        if(rob[rob_top].branch_target.value&3) {
+        if(rob.branch_target[rob_top].value&3) {
           fprintf(stderr, "error: unaligned branch target 0x%08x\n",
-              rob[rob_top].branch_target.value);
+              rob.branch_target[rob_top].value);
           show_statistics_and_exit(1);
         }
-        refetch_address = rob[rob_top].branch_target.value>>2;
-        refetch_rasp = rob[rob_top].rasp;
+        refetch_address = rob.branch_target[rob_top].value>>2;
+        refetch_rasp = rob.rasp[rob_top];
+        if(rob.btype[rob_top] != branch_type::BRANCH) {
+          refetch_history = rob.history[rob_top];
+        }
       }
-      rob[rob_top].busy = false;
+      if(rob.isstore[rob_top]) trace_tag(rob_top, pipeline_trace::MEMORY);
+      trace_retire(rob_top, false);
+      rob.busy.reset(rob_top);
       rob_top++;
-      rob_top &= NUM_TAGS-1;
+      rob_top &= num_tags-1;
       num_instructions++;
-    } else {
-      // TODO: commit stall
-      // fprintf(stderr, "%d, %d, %d, %d, %d, %d\n",
-      //    rob[rob_top].busy,
-      //    rob[rob_top].val.available,
-      //    rob[rob_top].branch_target.available,
-      //    (!rob[rob_top].isstore || false),
-      //    rob_top, rob_bottom);
+      num_committed++;
+      if(refetch || committed_store >= 0) break;
+    }
+    commit_width_counts[num_committed]++;
+    if(num_committed == 0 && rob.busy.test(rob_top)) {
+      count_pc_event(rob.pc[rob_top], pc_commit_stall);
     }
-    for(int i = 0; i < NUM_TAGS; ++i) {
-      if(rob[i].busy) {
-        rob[i].val = snoop(rob[i].val);
-        // if(!rob[i].branch_target.available) {
-        //   fprintf(stderr, "hoge\n");
-        // }
-        rob[i].branch_target = snoop(rob[i].branch_target);
+    if(refetch) recovering = true;
+    CommitStall commit_stall = CommitStall::COMMIT;
+    if(num_committed == 0) {
+      if(refetch || !rob.busy.test(rob_top)) {
+        commit_stall =
+          recovering ? CommitStall::REFETCH : CommitStall::FRONT_END;
+      } else if(rob.pending.test(rob_top)) {
+        commit_stall = rob.pending_reason[rob_top];
+      } else {
+        commit_stall = CommitStall::STORE;
       }
     }
+    rob_wakeup();
     if(refetch) {
-      for(int i = 0; i < NUM_TAGS; ++i) {
-        rob[i].busy = false;
+      if(trace) {
+        rob.busy.for_each([](int tag) { trace_retire(tag, true); });
+        for(int i = decoded_head; i < num_decoded; ++i) {
+          trace->retire(decoded[i].trace_id, true);
+        }
+        for(int i = 0; i < num_fetched; ++i) {
+          trace->retire(fetched[i].trace_id, true);
+        }
       }
-      rob_top = 0;
-      rob_bottom = 0;
+      rob_reset();
+      reset_cdb_reservations();
       lsbuffer.reset();
       brancher.reset();
       alu.reset();
@@ -755,13 +1956,18 @@ static void cas_run() {
         reg[i].rollback();
       }
     }
-    bool decode_stall = false;
+    // Dispatches in order up to dispatch_width instructions, stopping at
+    // the first that cannot be.
     StallReason stall_reason = StallReason::NO_STALL;
-    if(refetch) {
-      stall_reason = StallReason::INSTRUCTION_UNAVAILABLE;
-    } else if(decoded_instruction_available) {
+    int num_dispatched = 0;
+    while(!refetch && num_dispatched < dispatch_width) {
+      if(decoded_head == num_decoded) {
+        stall_reason = StallReason::INSTRUCTION_UNAVAILABLE;
+        break;
+      }
       // dispatch
-      uint32_t pword = decoded_instruction;
+      const fetch_entry &d = decoded[decoded_head];
+      uint32_t pword = d.pword;
       int opcode = pword>>26;
       int rs = (pword>>21)&31;
       int rt = (pword>>16)&31;
@@ -774,20 +1980,21 @@ static void cas_run() {
       int fd = sa|0x20;
       uint32_t uimm16 = (uint16_t)pword;
       uint32_t simm16 = (int16_t)pword;
-      int jt = (decoded_instruction_pc>>26<<26)|(pword&((1U<<26)-1));
+      int jt = (d.pc>>26<<26)|(pword&((1U<<26)-1));
       rob_val dispatch_rob;
-      dispatch_rob.busy = true;
       dispatch_rob.decode_success = true;
       dispatch_rob.isstore = false;
       dispatch_rob.btype = branch_type::NONBRANCH;
       dispatch_rob.val = from_tag(rob_bottom);
       dispatch_rob.branch_target =
-        from_value((uint32_t)(decoded_instruction_pc+1)*4);
-      dispatch_rob.predicted_branch = decoded_instruction_predicted_branch;
-      dispatch_rob.pc = decoded_instruction_pc;
-      dispatch_rob.rasp = decoded_instruction_rasp;
+        from_value((uint32_t)(d.pc+1)*4);
+      dispatch_rob.predicted_branch = d.predicted_branch;
+      dispatch_rob.pc = d.pc;
+      dispatch_rob.rasp = d.rasp;
+      dispatch_rob.history = d.history;
       dispatch_rob.set_reg = 0;
-      bool do_dispatch = !rob[rob_bottom].busy;
+      dispatch_rob.pending_reason = CommitStall::COMMIT;
+      bool do_dispatch = !rob.busy.test(rob_bottom);
       ls_entry1 dispatch_lsbuffer;
       rs_entry<4> dispatch_brancher;
       rs_entry<2> dispatch_alu;
@@ -797,6 +2004,7 @@ static void cas_run() {
       rs_entry<2> dispatch_fothers;
       dispatch_lsbuffer.busy = false;
       dispatch_lsbuffer.tag = rob_bottom;
+      dispatch_lsbuffer.pc = d.pc;
       dispatch_brancher.busy = false;
       dispatch_brancher.tag = rob_bottom;
       dispatch_alu.busy = false;
@@ -867,7 +2075,7 @@ static void cas_run() {
             case FUNCT_JALR:
               dispatch_rob.btype = branch_type::JUMPREGISTER;
               dispatch_rob.val =
-                from_value((uint32_t)(decoded_instruction_pc+1)*4);
+                from_value((uint32_t)(d.pc+1)*4);
               dispatch_rob.branch_target = get_reg(rs);
               if(funct == FUNCT_JALR) {
                 dispatch_rob.set_reg = rd;
@@ -878,7 +2086,7 @@ static void cas_run() {
                 fprintf(stderr,
                     "decode error: unknown SPECIAL funct: %d\n", funct);
                 fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                    decoded_instruction_pc*4, pword);
+                    d.pc*4, pword);
               }
               dispatch_rob.decode_success = false;
           }
@@ -887,7 +2095,7 @@ static void cas_run() {
         case OPCODE_JAL:
           dispatch_rob.btype = branch_type::JUMP;
           dispatch_rob.val =
-            from_value((uint32_t)(decoded_instruction_pc+1)*4);
+            from_value((uint32_t)(d.pc+1)*4);
           dispatch_rob.branch_target = from_value(jt*4);
           if(opcode == OPCODE_JAL) {
             dispatch_rob.set_reg = REG_RA;
@@ -909,9 +2117,9 @@ static void cas_run() {
             dispatch_brancher.operands[0] = get_reg(rs);
             dispatch_brancher.operands[1] = get_reg(rt);
             dispatch_brancher.operands[2] =
-              from_value((uint32_t)(decoded_instruction_pc+1)*4);
+              from_value((uint32_t)(d.pc+1)*4);
             dispatch_brancher.operands[3] =
-              from_value((uint32_t)(decoded_instruction_pc+1+simm16)*4);
+              from_value((uint32_t)(d.pc+1+simm16)*4);
           }
           break;
         case OPCODE_ADDIU:
@@ -972,16 +2180,16 @@ static void cas_run() {
                     fprintf(stderr,
                         "decode error: unknown BC1 condition: %d\n", rt);
                     fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                        decoded_instruction_pc*4, pword);
+                        d.pc*4, pword);
                   }
                   dispatch_rob.decode_success = false;
                 }
                 dispatch_brancher.operands[0] = get_reg(REG_CC0);
                 dispatch_brancher.operands[1] = from_value(0);
                 dispatch_brancher.operands[2] =
-                  from_value((uint32_t)(decoded_instruction_pc+1)*4);
+                  from_value((uint32_t)(d.pc+1)*4);
                 dispatch_brancher.operands[3] =
-                  from_value((uint32_t)(decoded_instruction_pc+1+simm16)*4);
+                  from_value((uint32_t)(d.pc+1+simm16)*4);
               }
               break;
             case COP1_FMT_MFC1:
@@ -1088,7 +2296,7 @@ static void cas_run() {
                     fprintf(stderr,
                         "decode error: unknown COP1.S funct: %d\n", funct);
                     fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                        decoded_instruction_pc*4, pword);
+                        d.pc*4, pword);
                   }
                   dispatch_rob.decode_success = false;
               }
@@ -1111,7 +2319,7 @@ static void cas_run() {
                     fprintf(stderr,
                         "decode error: unknown COP1.W funct: %d\n", funct);
                     fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                        decoded_instruction_pc*4, pword);
+                        d.pc*4, pword);
                   }
                   dispatch_rob.decode_success = false;
               }
@@ -1121,7 +2329,7 @@ static void cas_run() {
                 fprintf(stderr,
                     "decode error: unknown COP1 fmt: %d\n", fmt);
                 fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                    decoded_instruction_pc*4, pword);
+                    d.pc*4, pword);
               }
               dispatch_rob.decode_success = false;
           }
@@ -1157,6 +2365,7 @@ static void cas_run() {
             dispatch_lsbuffer.isstore = true;
             dispatch_lsbuffer.base = get_reg(rs);
             dispatch_lsbuffer.offset = simm16;
+            dispatch_lsbuffer.data = dispatch_rob.val;
           }
           break;
         default:
@@ -1164,24 +2373,38 @@ static void cas_run() {
             fprintf(stderr,
                 "decode error: unknown opcode: %d\n", opcode);
             fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
-                decoded_instruction_pc*4, pword);
+                d.pc*4, pword);
           }
           dispatch_rob.decode_success = false;
       }
       if(do_dispatch) {
         stall_reason = StallReason::NO_STALL;
-        // fprintf(stderr, "dispatch: pc=0x%08x, opcode=%d\n", decoded_instruction_pc, opcode);
+        // fprintf(stderr, "dispatch: pc=0x%08x, opcode=%d\n", d.pc, opcode);
         if(dispatch_rob.set_reg) {
           reg[dispatch_rob.set_reg].available = 0;
           reg[dispatch_rob.set_reg].tag = rob_bottom;
         }
-        rob[rob_bottom++] = dispatch_rob;
-        rob_bottom &= NUM_TAGS-1;
+        dispatch_rob.pending_reason =
+          dispatch_lsbuffer.busy ? CommitStall::LOAD :
+          dispatch_brancher.busy ? CommitStall::BRANCH :
+          dispatch_alu.busy ? CommitStall::ALU :
+          dispatch_fadd.busy ? CommitStall::FADD :
+          dispatch_fmul.busy ? CommitStall::FMUL :
+          dispatch_fcmp.busy ? CommitStall::FCMP :
+          dispatch_fothers.busy ? CommitStall::FOTHERS :
+          CommitStall::COMMIT;
+        if(trace) {
+          trace_ids[rob_bottom] = d.trace_id;
+          trace_tag(rob_bottom, pipeline_trace::DISPATCH);
+        }
+        rob_dispatch(rob_bottom++, dispatch_rob);
+        rob_bottom &= num_tags-1;
+        ++decoded_head;
+        ++num_dispatched;
       } else {
-        if(rob[rob_bottom].busy) {
+        if(rob.busy.test(rob_bottom)) {
           stall_reason = StallReason::ROB_UNAVAILABLE;
         }
-        decode_stall = true;
       }
       if(dispatch_lsbuffer.busy) {
         lsbuffer.dispatch(dispatch_lsbuffer);
@@ -1204,87 +2427,155 @@ static void cas_run() {
       if(dispatch_fothers.busy) {
         fp_others.dispatch(dispatch_fothers);
       }
+      if(!do_dispatch) break;
+    }
+    if(refetch) stall_reason = StallReason::INSTRUCTION_UNAVAILABLE;
+    if(num_dispatched == 0 || num_dispatched == dispatch_width) {
+      stall_reason_counts[static_cast<int>(stall_reason)]++;
+      if(stall_reason == StallReason::INSTRUCTION_UNAVAILABLE) {
+        // Charged to the next instruction in program order.
+        count_pc_event(
+            refetch ? refetch_address :
+            num_fetched > 0 ? fetched[0].pc : pc,
+            static_cast<int>(stall_reason));
+      } else if(stall_reason != StallReason::NO_STALL) {
+        count_pc_event(decoded[decoded_head].pc,
+                       static_cast<int>(stall_reason));
+      }
     } else {
-      stall_reason = StallReason::INSTRUCTION_UNAVAILABLE;
+      partial_stall_reason_counts[static_cast<int>(stall_reason)]++;
     }
-    stall_reason_counts[static_cast<int>(stall_reason)]++;
+    dispatch_width_counts[num_dispatched]++;
+    if(num_dispatched > 0) recovering = false;
+    bool decode_stall = decoded_head < num_decoded;
     bool fetch_stall = false;
     if(refetch) {
-      decoded_instruction_available = false;
-    } else if(!decode_stall && fetched_instruction_available) {
+      decoded_head = num_decoded = 0;
+    } else if(!decode_stall && num_fetched > 0) {
       // decode
       // do nothing on simulation, decode when dispatching
-      decoded_instruction = fetched_instruction;
-      decoded_instruction_pc = fetched_instruction_pc;
-      decoded_instruction_predicted_branch =
-        fetched_instruction_predicted_branch;
-      decoded_instruction_available = true;
-      decoded_instruction_rasp = fetched_instruction_rasp;
-    } else if(fetched_instruction_available) {
+      copy(fetched, fetched+num_fetched, decoded);
+      decoded_head = 0;
+      num_decoded = num_fetched;
+    } else if(num_fetched > 0) {
       fetch_stall = true;
+    } else if(!decode_stall) {
+      // a bubble from an I-cache miss
+      decoded_head = num_decoded = 0;
     }
     if(refetch) {
-      fetched_instruction_available = false;
+      num_fetched = 0;
       pc = refetch_address;
       rasp = refetch_rasp;
+      branch_history = refetch_history;
+      icache_pc = -1;
+    } else if(!fetch_stall && icache_busy(pc)) {
+      // wait for the I-cache
+      num_fetched = 0;
     } else if(!fetch_stall) {
-      // fetch
-      if(pc < 0 || pc >= (1<<15)) {
-        fprintf(stderr, "error: program counter 0x%08x is out of range\n",
-            pc*4);
-        show_statistics_and_exit(1);
-      }
-      fetched_instruction = ram[pc];
-      fetched_instruction_pc = pc;
-      fetched_instruction_available = true;
-      fetched_instruction_rasp = rasp;
-      int bp = pc+1;
-      {
-        uint32_t pword = fetched_instruction;
-        int opcode = pword>>26;
-        int rs = (pword>>21)&31;
-        int funct = pword&63;
-        int fmt = rs;
-        int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
-        if(opcode == OPCODE_J || opcode == OPCODE_JAL) {
-          bp = jt;
-          if(opcode == OPCODE_JAL) {
-            rasp = (rasp-1)&31;
-            ra_stack[rasp] = (uint32_t)(pc+1)*4;
+      // Fetches up to fetch_width instructions, up to a predicted jump and,
+      // with an I-cache, within the line read.
+      num_fetched = 0;
+      do {
+        if(pc < 0 || pc >= num_fetchable_pcs) {
+          fprintf(stderr, "error: program counter 0x%08x is out of range\n",
+              pc*4);
+          show_statistics_and_exit(1);
+        }
+        fetch_entry &f = fetched[num_fetched++];
+        f.pword = ram[pc];
+        f.pc = pc;
+        f.rasp = rasp;
+        f.history = branch_history;
+        f.trace_id = trace ? trace->fetch(pc, f.pword) : -1;
+        int bp = pc+1;
+        {
+          uint32_t pword = f.pword;
+          int opcode = pword>>26;
+          int rs = (pword>>21)&31;
+          int funct = pword&63;
+          int fmt = rs;
+          int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+          if(opcode == OPCODE_J || opcode == OPCODE_JAL) {
+            bp = jt;
+            if(opcode == OPCODE_JAL) {
+              rasp = (rasp-1)&(ras_depth-1);
+              ra_stack[rasp] = (uint32_t)(pc+1)*4;
+            }
+          } else if(
+              opcode == OPCODE_BEQ || opcode == OPCODE_BNE ||
+              (opcode == OPCODE_COP1 && fmt == COP1_FMT_BRANCH)) {
+            int target = pc+1+(int16_t)pword;
+            bool taken = predictor->predict(pc, target, branch_history);
+            branch_history =
+              ((branch_history<<1) | taken) & branch_history_mask;
+            if(taken) bp = target;
+          } else if(is_return(pword)) {
+            bp = ra_stack[rasp]>>2;
+            rasp = (rasp+1)&(ras_depth-1);
+          } else if(
+              opcode == OPCODE_SPECIAL &&
+              (funct == FUNCT_JR || funct == FUNCT_JALR) && btb->enabled()) {
+            num_btb_lookups++;
+            int target = btb->lookup(pc);
+            if(target >= 0) {
+              num_btb_hits++;
+              bp = target;
+            }
           }
-        } else if(
-            (opcode == OPCODE_BEQ || opcode == OPCODE_BNE ||
-             (opcode == OPCODE_COP1 && fmt == COP1_FMT_BRANCH)) &&
-            (int16_t)pword < 0) {
-          bp = pc+1+(int16_t)pword;
-        } else if(
-            opcode == OPCODE_SPECIAL && funct == FUNCT_JR &&
-            rs == 31) {
-          bp = ra_stack[rasp]>>2;
-          rasp = (rasp+1)&31;
         }
-      }
-      fetched_instruction_predicted_branch = (uint32_t)bp*4;
-      pc = bp;
+        f.predicted_branch = (uint32_t)bp*4;
+        bool redirected = bp != pc+1;
+        pc = bp;
+        if(redirected) break;
+      } while(num_fetched < fetch_width &&
+              !(icache->enabled() && pc*4 % icache->line_size() == 0));
     }
-    lsbuffer.do_issue(last_rob_top, rob_top_committable,
-                      last_rob_val);
+    lsbuffer.do_issue(last_rob_top, committed_store, committed_store_value);
     brancher.do_issue();
     alu.do_issue();
     fp_adder.do_issue();
     fp_multiplier.do_issue();
     fp_comparator.do_issue();
     fp_others.do_issue();
-    cdb[0] = lsbuffer.calculation_pipeline[0];
-    cdb[1] = brancher.calculation_pipeline[0];
-    cdb[2] = alu.calculation_pipeline[0];
-    cdb[3] = fp_adder.calculation_pipeline[0];
-    cdb[4] = fp_multiplier.calculation_pipeline[0];
-    cdb[5] = fp_comparator.calculation_pipeline[0];
-    cdb[6] = fp_others.calculation_pipeline[0];
+    cdb_size = 0;
+    add_to_cdb(lsbuffer.calculation_pipeline[0], lsbuffer.num_ports());
+    add_to_cdb(brancher.calculation_pipeline[0], brancher.num_ports());
+    add_to_cdb(alu.calculation_pipeline[0], alu.num_ports());
+    add_to_cdb(fp_adder.calculation_pipeline[0], fp_adder.num_ports());
+    add_to_cdb(fp_multiplier.calculation_pipeline[0],
+               fp_multiplier.num_ports());
+    add_to_cdb(fp_comparator.calculation_pipeline[0],
+               fp_comparator.num_ports());
+    add_to_cdb(fp_others.calculation_pipeline[0], fp_others.num_ports());
+    index_cdb();
+    if(trace) {
+      for(int i = 0; i < cdb_size; ++i) {
+        trace_tag(cdb[i].tag, pipeline_trace::WRITEBACK);
+      }
+    }
+    cdb_reservations[cdb_cycle & (cdb_ring_size-1)] = 0;
+    cdb_cycle++;
     // fprintf(stderr, "rob_top=%d, rob_bottom=%d\n", rob_top, rob_bottom);
+    if(show_statistics) {
+      int rob_entries = (rob_bottom - rob_top) & (num_tags-1);
+      if(rob_entries == 0 && rob.busy.test(rob_top)) rob_entries = num_tags;
+      int occupancy[num_occupancy_structures] = {
+        rob_entries,
+        lsbuffer.num_busy1(), lsbuffer.num_busy2(),
+        brancher.num_busy(), alu.num_busy(), fp_adder.num_busy(),
+        fp_multiplier.num_busy(), fp_comparator.num_busy(),
+        fp_others.num_busy(),
+        cdb_size,
+      };
+      for(int i = 0; i < num_occupancy_structures; ++i) {
+        occupancy_counts[i][occupancy[i]]++;
+      }
+    }
+    commit_stall_counts[static_cast<int>(commit_stall)]++;
     num_cycles++;
-    if(num_cycles % 100000000 == 0) {
+    if(num_cycles == next_interval_cycle) write_interval_row();
+    if(num_cycles % cycles_per_report == 0) {
       if(show_statistics) {
         fprintf(stderr, "current result:\n");
         do_show_statistics();
@@ -1295,25 +2586,266 @@ static void cas_run() {
             num_cycles, num_instructions);
       }
     }
+    // A traced instruction sees every cycle.
+    bool tracing = trace &&
+      ((num_cycles >= trace_from && num_cycles < trace_to) ||
+       trace->num_in_flight() > 0);
+    if(skip_idle && rs_polled_unready && !show_commit_log && !tracing) {
+      idle_snapshot snapshot;
+      state_buffer &state = snapshot.state;
+      state.put(pc);
+      state.put(recovering);
+      state.put(num_fetched);
+      for(int i = 0; i < num_fetched; ++i) {
+        save_fetch_entry(state, fetched[i]);
+      }
+      state.put(num_decoded - decoded_head);
+      for(int i = decoded_head; i < num_decoded; ++i) {
+        save_fetch_entry(state, decoded[i]);
+      }
+      state.put(icache_pc);
+      state.put(icache_wait);
+      state.put64(icache->num_changes());
+      state.put64(dcache->num_changes());
+      state.put(rasp);
+      for(int i = 0; i < ras_depth; ++i) state.put(ra_stack[i]);
+      state.put64(branch_history);
+      state.put64(predictor->num_changes());
+      state.put64(btb->num_changes());
+      for(const auto &shadow : shadow_predictors) {
+        state.put64(shadow->num_changes());
+      }
+      state.put64(shadow_history);
+      state.put(rob_top);
+      state.put(rob_bottom);
+      for(int i = 0; i < num_tags; ++i) {
+        state.put(rob.busy.test(i));
+        if(!rob.busy.test(i)) continue;
+        state.put(rob.decode_success[i]);
+        state.put(rob.isstore[i]);
+        state.put(static_cast<int>(rob.btype[i]));
+        state.put(rob.set_reg[i]);
+        state.put_operand(rob.val[i]);
+        state.put_operand(rob.branch_target[i]);
+        state.put(rob.predicted_branch[i]);
+        state.put(rob.pc[i]);
+        state.put(rob.rasp[i]);
+        state.put64(rob.history[i]);
+        state.put(static_cast<int>(rob.pending_reason[i]));
+      }
+      for(int i = 0; i <= REG_CC0; ++i) {
+        state.put(reg[i].available);
+        state.put(reg[i].value);
+        if(!reg[i].available) state.put(reg[i].tag);
+      }
+      // The CDB reservations follow from the results in the pipelines.
+      state.put(cdb_size);
+      for(int i = 0; i < cdb_size; ++i) state.put_result(cdb[i]);
+      lsbuffer.save_state(state);
+      brancher.save_state(state);
+      alu.save_state(state);
+      fp_adder.save_state(state);
+      fp_multiplier.save_state(state);
+      fp_comparator.save_state(state);
+      fp_others.save_state(state);
+      snapshot.hash = 14695981039346656037ULL;
+      for(uint32_t w : state.words) {
+        snapshot.hash = (snapshot.hash ^ w) * 1099511628211ULL;
+      }
+      skip_idle_periods(snapshot);
+    }
+    rs_polled_unready = false;
   }
 }
 
-void cas_main() {
-  std::fill(ram,ram+(1<<20),0x55555555U);
-  int load_pc = 0;
+void cas_read_program(FILE *fp, vector<uint32_t> &program) {
+  program.clear();
   for(;;) {
     unsigned char chs[4];
-    size_t readsize = fread(chs,1,4,stdin);
+    size_t readsize = fread(chs,1,4,fp);
     if(readsize<4) {
       fprintf(stderr, "input error during loading program\n");
-      show_statistics_and_exit(1);
+      exit(1);
     }
     uint32_t load_pword = (chs[0]<<24)|(chs[1]<<16)|(chs[2]<<8)|chs[3];
     if(load_pword == (uint32_t)-1) break;
-    ram[load_pc++] = load_pword;
+    if(program.size() + 32 >= (1<<20)) {
+      fprintf(stderr, "error: program too large\n");
+      exit(1);
+    }
+    program.push_back(load_pword);
+  }
+}
+
+void cas_main() {
+  vector<uint32_t> program;
+  cas_read_program(stdin, program);
+  cas_config config = default_cas_config;
+  if(!cas_config_file.empty()) read_cas_config(cas_config_file, config);
+  for(const string &param : cas_config_params) {
+    set_cas_config_param(param, config);
   }
+  cas_run_program(program, config, "");
+}
+
+void cas_run_program(const vector<uint32_t> &program,
+                     const cas_config &config, const string &result_file) {
+  std::fill(ram,ram+(1<<20),0x55555555U);
+  int load_pc = 0;
+  for(uint32_t pword : program) ram[load_pc++] = pword;
   for(int i = 0; i < 32; ++i) ram[load_pc++] = 0U;
-  cas_run();
+
+  check_cas_config(config);
+  cas_result_file = result_file;
+  num_tags = config.rob_size;
+  ras_depth = config.ras_depth;
+  clk = config.clk;
+  baudrate = config.baudrate;
+  clk_per_byte = clk / (baudrate / (num_databits+stopbit+1));
+  predictor = make_branch_predictor(config.branch_predictor,
+      config.bp_table_entries, config.bp_history_length);
+  btb.reset(new branch_target_buffer(config.btb_entries, config.btb_ways));
+  branch_history = 0;
+  shadow_history_mask =
+    config.bp_history_length >= 64 ? ~(uint64_t)0 :
+    ((uint64_t)1 << config.bp_history_length) - 1;
+  branch_history_mask =
+    config.branch_predictor == "static" ? 0 : shadow_history_mask;
+  if(show_statistics) {
+    for(int i = 0; branch_predictor_names[i]; ++i) {
+      shadow_predictors.push_back(make_branch_predictor(
+          branch_predictor_names[i],
+          config.bp_table_entries, config.bp_history_length));
+    }
+    shadow_missed_branches.assign(shadow_predictors.size(), 0);
+  }
+  shadow_history = 0;
+  predictor_name = config.branch_predictor;
+  icache.reset(new cache(config.icache_size, config.icache_ways,
+      config.icache_line_size, config.icache_replacement,
+      config.icache_hit_latency, config.icache_miss_latency));
+  dcache.reset(new cache(config.dcache_size, config.dcache_ways,
+      config.dcache_line_size, config.dcache_replacement,
+      config.dcache_hit_latency, config.dcache_miss_latency));
+  pc_event_counts.clear();
+  if(show_statistics || !pc_stats_file.empty()) {
+    pc_event_counts.assign((size_t)num_fetchable_pcs*num_pc_events, 0);
+    icache->enable_pc_stats(num_fetchable_pcs);
+    dcache->enable_pc_stats(num_fetchable_pcs);
+  }
+  trace.reset(trace_file.empty() ?
+      nullptr : new pipeline_trace(trace_from, trace_to));
+  if(machine_accepts<default_machine>(config)) {
+    cas_run<default_machine>(config);
+  } else {
+    cas_run<runtime_machine>(config);
+  }
+}
+
+// Prints the miss rate and the pcs with the most misses.
+static void show_cache_statistics(const char *name, const cache &c) {
+  fprintf(stderr,
+          " %s miss:           %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+          name, c.num_misses, c.num_accesses,
+          c.num_misses*100.0/c.num_accesses);
+  vector<int> pcs;
+  for(int pc = 0; pc < (int)c.pc_misses.size(); ++pc) {
+    if(c.pc_misses[pc]) pcs.push_back(pc);
+  }
+  int num_shown = min((int)pcs.size(), 10);
+  partial_sort(pcs.begin(), pcs.begin()+num_shown, pcs.end(),
+      [&c](int a, int b) { return c.pc_misses[a] > c.pc_misses[b]; });
+  for(int i = 0; i < num_shown; ++i) {
+    fprintf(stderr,
+            "   pc=0x%08x: %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            (uint32_t)pcs[i]*4, c.pc_misses[pcs[i]], c.pc_accesses[pcs[i]],
+            c.pc_misses[pcs[i]]*100.0/c.pc_accesses[pcs[i]]);
+  }
+}
+
+// Prints the pcs with the most counts of a pc event, if there are any.
+static void show_pc_events(int event, const char *kind, const char *name) {
+  uint64_t total = 0;
+  vector<int> pcs;
+  for(int pc = 0; pc < num_fetchable_pcs; ++pc) {
+    uint64_t n = pc_event_counts[(size_t)pc*num_pc_events + event];
+    if(n) pcs.push_back(pc);
+    total += n;
+  }
+  if(total == 0) return;
+  auto count = [event](int pc) {
+    return pc_event_counts[(size_t)pc*num_pc_events + event];
+  };
+  int num_shown = min((int)pcs.size(), 5);
+  partial_sort(pcs.begin(), pcs.begin()+num_shown, pcs.end(),
+      [&count](int a, int b) { return count(a) > count(b); });
+  fprintf(stderr, " %s by pc (%s): %" PRId64 "\n", kind, name, total);
+  for(int i = 0; i < num_shown; ++i) {
+    fprintf(stderr,
+            "   pc=0x%08x: %9" PRId64 " (%5.2f%%)\n",
+            (uint32_t)pcs[i]*4, count(pcs[i]), count(pcs[i])*100.0/total);
+  }
+}
+
+// Writes the per-pc counts as a CSV table with a row for each pc that
+// has any.
+static void write_pc_stats_file() {
+  FILE *fp = fopen(pc_stats_file.c_str(), "w");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", pc_stats_file.c_str());
+    return;
+  }
+  fprintf(fp,
+      "pc,stall_instruction,stall_rob,stall_lsbuffer,stall_brancher,"
+      "stall_alu,stall_fp_adder,stall_fp_multiplier,stall_fp_comparator,"
+      "stall_fp_others,commit_stall,branch_miss,jr_miss,"
+      "icache_miss,dcache_miss\n");
+  for(int pc = 0; pc < num_fetchable_pcs; ++pc) {
+    const uint64_t *counts = &pc_event_counts[(size_t)pc*num_pc_events];
+    uint64_t icache_misses =
+      icache->enabled() ? icache->pc_misses[pc] : 0;
+    uint64_t dcache_misses =
+      dcache->enabled() ? dcache->pc_misses[pc] : 0;
+    bool any = icache_misses || dcache_misses;
+    for(int i = 1; i < num_pc_events; ++i) any = any || counts[i];
+    if(!any) continue;
+    fprintf(fp, "0x%08x", (uint32_t)pc*4);
+    for(int i = 1; i < num_pc_events; ++i) {
+      fprintf(fp, ",%" PRIu64, counts[i]);
+    }
+    fprintf(fp, ",%" PRIu64 ",%" PRIu64 "\n", icache_misses, dcache_misses);
+  }
+  fclose(fp);
+}
+
+// Prints the mean number of busy entries of a structure, how often it was
+// full, and the cycles by the number of busy entries.
+static void show_occupancy(int structure) {
+  const uint64_t *counts = occupancy_counts[structure];
+  int capacity = occupancy_capacity[structure];
+  uint64_t sum = 0;
+  for(int i = 0; i <= capacity; ++i) sum += counts[i] * i;
+  fprintf(stderr,
+          " %s occupancy (%d entries): mean %.2f, full %5.2f%%\n",
+          occupancy_names[structure], capacity, (double)sum/num_cycles,
+          counts[capacity]*100.0/num_cycles);
+  for(int i = 0; i <= capacity; ++i) {
+    if(counts[i] == 0) continue;
+    fprintf(stderr,
+            " %20" PRId64 ": %d (%5.2f%%)\n",
+            counts[i], i, counts[i]*100.0/num_cycles);
+  }
+}
+
+// Prints the cycles by the number of instructions handled in them.
+static void show_width_histogram(const char *name, const uint64_t counts[],
+                                 int width) {
+  fprintf(stderr, " cycles by instructions %s:\n", name);
+  for(int i = 0; i <= width; ++i) {
+    fprintf(stderr,
+            " %20" PRId64 ": %d (%5.2f%%)\n",
+            counts[i], i, counts[i]*100.0/num_cycles);
+  }
 }
 
 static void do_show_statistics() {
@@ -1342,43 +2874,115 @@ static void do_show_statistics() {
           num_missed_jumpregisters,
           num_committed_jumpregisters,
           num_missed_jumpregisters*100.0/num_committed_jumpregisters);
+  fprintf(stderr, " branch predictor: %s\n", predictor_name.c_str());
+  if(btb->enabled()) {
+    fprintf(stderr,
+            " BTB hit:                %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            num_btb_hits, num_btb_lookups,
+            num_btb_hits*100.0/num_btb_lookups);
+  }
+  fprintf(stderr, " misprediction by predictor at commit:\n");
+  for(size_t i = 0; i < shadow_predictors.size(); ++i) {
+    fprintf(stderr,
+            " %22s: %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            branch_predictor_names[i],
+            shadow_missed_branches[i],
+            num_committed_branches,
+            shadow_missed_branches[i]*100.0/num_committed_branches);
+  }
+  if(icache->enabled()) show_cache_statistics("I-cache", *icache);
+  if(dcache->enabled()) show_cache_statistics("D-cache", *dcache);
+  fprintf(stderr, " loads performed:        %9" PRId64 "\n",
+          num_performed_loads);
+  if(store_forwarding) {
+    fprintf(stderr,
+            " forwarded from a store: %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            num_forwarded_loads, num_performed_loads,
+            num_forwarded_loads*100.0/num_performed_loads);
+  }
+  if(speculative_loads) {
+    fprintf(stderr,
+            " speculative:            %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            num_speculative_loads, num_performed_loads,
+            num_speculative_loads*100.0/num_performed_loads);
+    fprintf(stderr,
+            " memory-order violation: %9" PRId64 " / %9" PRId64 " (%5.2f%%)\n",
+            num_memory_order_violations, num_speculative_loads,
+            num_memory_order_violations*100.0/num_speculative_loads);
+  }
   fprintf(stderr, " stall because:\n");
-  fprintf(stderr,
-      " %20" PRId64 ": Instruction unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::INSTRUCTION_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": ROB unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::ROB_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": Load/Store Buffer unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::MEM_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": Brancher unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::BRANCHER_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": ALU unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::ALU_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": FP Adder unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::FADD_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": FP Multiplier unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::FMUL_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": FP Comparator unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::FCMP_UNAVAILABLE)]);
-  fprintf(stderr,
-      " %20" PRId64 ": FP Div/Sqrt/Ftoi/Itof unavailable\n",
-      stall_reason_counts[
-        static_cast<int>(StallReason::FOTHERS_UNAVAILABLE)]);
+  for(int i = 1; i < NumStallReasons; ++i) {
+    fprintf(stderr, " %20" PRId64 ": %s\n",
+        stall_reason_counts[i], stall_reason_names[i]);
+  }
+  fprintf(stderr, " cycles by what commit waited for:\n");
+  for(int i = 0; i < NumCommitStalls; ++i) {
+    fprintf(stderr, " %20" PRId64 ": %s (cpi %5.3f)\n",
+        commit_stall_counts[i], commit_stall_names[i],
+        (double)commit_stall_counts[i]/num_instructions);
+  }
+  if(dispatch_width > 1) {
+    fprintf(stderr, " partial dispatch because:\n");
+    for(int i = 1; i < NumStallReasons; ++i) {
+      fprintf(stderr, " %20" PRId64 ": %s\n",
+          partial_stall_reason_counts[i], stall_reason_names[i]);
+    }
+    show_width_histogram("dispatched", dispatch_width_counts,
+                         dispatch_width);
+  }
+  if(commit_width > 1) {
+    show_width_histogram("committed", commit_width_counts, commit_width);
+  }
+  for(int i = 0; i < num_occupancy_structures; ++i) {
+    show_occupancy(i);
+  }
+  if(!pc_event_counts.empty()) {
+    for(int i = 1; i < NumStallReasons; ++i) {
+      show_pc_events(i, "dispatch stall", stall_reason_names[i]);
+    }
+    show_pc_events(pc_commit_stall, "commit stall", "ROB head not ready");
+    show_pc_events(pc_branch_miss, "misprediction", "branch");
+    show_pc_events(pc_jr_miss, "misprediction", "jump register");
+  }
+}
+
+const char cas_result_columns[] =
+  "cycles,instructions,ipc,branch_miss_rate,jr_miss_rate,"
+  "stall_instruction,stall_rob,stall_lsbuffer,stall_brancher,stall_alu,"
+  "stall_fp_adder,stall_fp_multiplier,stall_fp_comparator,stall_fp_others,"
+  "icache_miss_rate,dcache_miss_rate";
+
+// Writes the statistics as a CSV record. The file is renamed into place,
+// so a reader never sees a partial record.
+// Writes ",n/total", or an empty field if there is nothing to divide by.
+static void write_rate(FILE *fp, uint64_t n, uint64_t total) {
+  if(total == 0) {
+    fprintf(fp, ",");
+  } else {
+    fprintf(fp, ",%.4f", (double)n/total);
+  }
+}
+
+static void write_result_file() {
+  string tmp_file = cas_result_file + ".tmp";
+  FILE *fp = fopen(tmp_file.c_str(), "w");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", tmp_file.c_str());
+    return;
+  }
+  fprintf(fp, "%" PRIu64 ",%" PRIu64 ",%.4f",
+      num_cycles, num_instructions,
+      (double)num_instructions/num_cycles);
+  write_rate(fp, num_missed_branches, num_committed_branches);
+  write_rate(fp, num_missed_jumpregisters, num_committed_jumpregisters);
+  for(int i = 1; i < NumStallReasons; ++i) {
+    fprintf(fp, ",%" PRIu64, stall_reason_counts[i]);
+  }
+  write_rate(fp, icache->num_misses, icache->num_accesses);
+  write_rate(fp, dcache->num_misses, dcache->num_accesses);
+  fprintf(fp, "\n");
+  fclose(fp);
+  rename(tmp_file.c_str(), cas_result_file.c_str());
 }
 
 static void show_statistics_and_exit(int status) {
@@ -1386,5 +2990,12 @@ static void show_statistics_and_exit(int status) {
     fprintf(stderr, "final result:\n");
     do_show_statistics();
   }
+  if(status == 0 && !cas_result_file.empty()) write_result_file();
+  if(!pc_stats_file.empty()) write_pc_stats_file();
+  if(trace) trace->write(trace_file);
+  if(interval_fp) {
+    if(num_cycles > interval_start.num_cycles) write_interval_row();
+    fclose(interval_fp);
+  }
   exit(status);
 }
@@ -1,8 +1,24 @@
 #ifndef CAS_H_
 #define CAS_H_
 
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "cas_config.h"
+
 extern bool cas_use_native;
 
 void cas_main(void);
 
+// Reads a program up to the 0xFFFFFFFF terminator.
+void cas_read_program(FILE *fp, std::vector<uint32_t> &program);
+// Simulates program with its input on stdin. Does not return. If
+// result_file is not empty, a CSV record with cas_result_columns is
+// written there when the program halts.
+void cas_run_program(const std::vector<uint32_t> &program,
+                     const cas_config &config,
+                     const std::string &result_file);
+extern const char cas_result_columns[];
+
 #endif /* CAS_H_ */
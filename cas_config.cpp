@@ -0,0 +1,277 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include "branch_predictor.h"
+#include "cache.h"
+#include "cas_config.h"
+using namespace std;
+
+const cas_config default_cas_config = {
+  32,       // rob_size
+  1, 1, 1,  // fetch_width, dispatch_width, commit_width
+  0,        // cdb_width
+  2, 2, 1,  // lsbuffer_address_entries, lsbuffer_memory_entries, ports
+  0, 0,     // store_forwarding, speculative_loads
+  1, 2, 1,  // brancher
+  1, 2, 1,  // alu
+  2, 2, 1,  // fp_adder
+  2, 2, 1,  // fp_multiplier
+  1, 2, 1,  // fp_comparator
+  7, 2, 1,  // fp_others
+  32,       // ras_depth
+  66.666e6, // clk
+  460800.0, // baudrate
+  "static", // branch_predictor
+  4096,     // bp_table_entries
+  12,       // bp_history_length
+  0,        // btb_entries
+  1,        // btb_ways
+  0, 1, 32, "lru", 1, 8,   // icache
+  0, 2, 32, "lru", 3, 12   // dcache
+};
+
+static const struct {
+  const char *name;
+  int cas_config::*member;
+  int min;
+  int max;
+  bool power_of_two;
+} int_params[] = {
+  {"rob_size", &cas_config::rob_size, 2, max_rob_size, true},
+  {"fetch_width", &cas_config::fetch_width, 1, max_pipeline_width, false},
+  {"dispatch_width", &cas_config::dispatch_width,
+   1, max_pipeline_width, false},
+  {"commit_width", &cas_config::commit_width, 1, max_pipeline_width, false},
+  {"cdb_width", &cas_config::cdb_width,
+   0, num_units * max_unit_ports, false},
+  {"lsbuffer_address_entries", &cas_config::lsbuffer_address_entries,
+   1, max_unit_entries, false},
+  {"lsbuffer_memory_entries", &cas_config::lsbuffer_memory_entries,
+   1, max_unit_entries, false},
+  {"lsbuffer_ports", &cas_config::lsbuffer_ports, 1, max_unit_ports, false},
+  {"store_forwarding", &cas_config::store_forwarding, 0, 1, false},
+  {"speculative_loads", &cas_config::speculative_loads, 0, 1, false},
+  {"brancher_latency", &cas_config::brancher_latency,
+   1, max_unit_latency, false},
+  {"brancher_entries", &cas_config::brancher_entries,
+   1, max_unit_entries, false},
+  {"brancher_ports", &cas_config::brancher_ports, 1, max_unit_ports, false},
+  {"alu_latency", &cas_config::alu_latency, 1, max_unit_latency, false},
+  {"alu_entries", &cas_config::alu_entries, 1, max_unit_entries, false},
+  {"alu_ports", &cas_config::alu_ports, 1, max_unit_ports, false},
+  {"fp_adder_latency", &cas_config::fp_adder_latency,
+   1, max_unit_latency, false},
+  {"fp_adder_entries", &cas_config::fp_adder_entries,
+   1, max_unit_entries, false},
+  {"fp_adder_ports", &cas_config::fp_adder_ports, 1, max_unit_ports, false},
+  {"fp_multiplier_latency", &cas_config::fp_multiplier_latency,
+   1, max_unit_latency, false},
+  {"fp_multiplier_entries", &cas_config::fp_multiplier_entries,
+   1, max_unit_entries, false},
+  {"fp_multiplier_ports", &cas_config::fp_multiplier_ports,
+   1, max_unit_ports, false},
+  {"fp_comparator_latency", &cas_config::fp_comparator_latency,
+   1, max_unit_latency, false},
+  {"fp_comparator_entries", &cas_config::fp_comparator_entries,
+   1, max_unit_entries, false},
+  {"fp_comparator_ports", &cas_config::fp_comparator_ports,
+   1, max_unit_ports, false},
+  {"fp_others_latency", &cas_config::fp_others_latency,
+   1, max_unit_latency, false},
+  {"fp_others_entries", &cas_config::fp_others_entries,
+   1, max_unit_entries, false},
+  {"fp_others_ports", &cas_config::fp_others_ports, 1, max_unit_ports, false},
+  {"ras_depth", &cas_config::ras_depth, 1, max_ras_depth, true},
+  {"bp_table_entries", &cas_config::bp_table_entries,
+   1, max_bp_table_entries, true},
+  {"bp_history_length", &cas_config::bp_history_length,
+   0, max_bp_history_length, false},
+  {"btb_entries", &cas_config::btb_entries, 0, max_btb_entries, true},
+  {"btb_ways", &cas_config::btb_ways, 1, max_btb_entries, true},
+  {"icache_size", &cas_config::icache_size, 0, max_cache_size, true},
+  {"icache_ways", &cas_config::icache_ways, 1, max_cache_size/4, true},
+  {"icache_line_size", &cas_config::icache_line_size,
+   4, max_cache_line_size, true},
+  {"icache_hit_latency", &cas_config::icache_hit_latency,
+   1, max_cache_latency, false},
+  {"icache_miss_latency", &cas_config::icache_miss_latency,
+   1, max_cache_latency, false},
+  {"dcache_size", &cas_config::dcache_size, 0, max_cache_size, true},
+  {"dcache_ways", &cas_config::dcache_ways, 1, max_cache_size/4, true},
+  {"dcache_line_size", &cas_config::dcache_line_size,
+   4, max_cache_line_size, true},
+  {"dcache_hit_latency", &cas_config::dcache_hit_latency,
+   1, max_cache_latency, false},
+  {"dcache_miss_latency", &cas_config::dcache_miss_latency,
+   1, max_cache_latency, false},
+};
+
+static const struct {
+  const char *name;
+  double cas_config::*member;
+} double_params[] = {
+  {"clk", &cas_config::clk},
+  {"baudrate", &cas_config::baudrate},
+};
+
+static const struct {
+  const char *name;
+  string cas_config::*member;
+} string_params[] = {
+  {"branch_predictor", &cas_config::branch_predictor},
+  {"icache_replacement", &cas_config::icache_replacement},
+  {"dcache_replacement", &cas_config::dcache_replacement},
+};
+
+static string trim(const string &s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if(begin == string::npos) return "";
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(begin, end-begin+1);
+}
+
+// Returns false if the assignment is malformed or the name is unknown.
+static bool set_param(const string &assignment, cas_config &config) {
+  size_t eq = assignment.find('=');
+  if(eq == string::npos) return false;
+  string name = trim(assignment.substr(0, eq));
+  string value = trim(assignment.substr(eq+1));
+  if(value.empty()) return false;
+  char *end;
+  for(const auto &param : int_params) {
+    if(name != param.name) continue;
+    errno = 0;
+    long v = strtol(value.c_str(), &end, 0);
+    if(*end) return false;
+    // Checked before narrowing to int, which could wrap into the range.
+    if(errno == ERANGE || v < param.min || v > param.max) {
+      fprintf(stderr, "error: %s must be between %d and %d\n",
+          param.name, param.min, param.max);
+      exit(1);
+    }
+    config.*param.member = v;
+    return true;
+  }
+  for(const auto &param : double_params) {
+    if(name != param.name) continue;
+    double v = strtod(value.c_str(), &end);
+    if(*end) return false;
+    config.*param.member = v;
+    return true;
+  }
+  for(const auto &param : string_params) {
+    if(name != param.name) continue;
+    config.*param.member = value;
+    return true;
+  }
+  return false;
+}
+
+void read_cas_config(const string &filename, cas_config &config) {
+  FILE *fp = fopen(filename.c_str(), "r");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", filename.c_str());
+    exit(1);
+  }
+  char buf[256];
+  for(int lineno = 1; fgets(buf, sizeof(buf), fp); ++lineno) {
+    string line = buf;
+    line = trim(line.substr(0, line.find('#')));
+    if(line.empty()) continue;
+    if(!set_param(line, config)) {
+      fprintf(stderr, "error: %s:%d: invalid parameter: %s\n",
+          filename.c_str(), lineno, line.c_str());
+      exit(1);
+    }
+  }
+  fclose(fp);
+}
+
+void set_cas_config_param(const string &assignment, cas_config &config) {
+  if(!set_param(assignment, config)) {
+    fprintf(stderr, "error: invalid parameter: %s\n", assignment.c_str());
+    exit(1);
+  }
+}
+
+static void check_cache_config(const char *name, int size, int ways,
+    int line_size, const string &replacement,
+    int hit_latency, int miss_latency) {
+  bool known_replacement = false;
+  for(int i = 0; cache_replacement_names[i]; ++i) {
+    if(replacement == cache_replacement_names[i]) known_replacement = true;
+  }
+  if(!known_replacement) {
+    fprintf(stderr, "error: unknown %s replacement: %s\n",
+        name, replacement.c_str());
+    exit(1);
+  }
+  if(size > 0 && size < ways * line_size) {
+    fprintf(stderr, "error: %s_size must be at least %s_ways * %s_line_size\n",
+        name, name, name);
+    exit(1);
+  }
+  if(miss_latency < hit_latency) {
+    fprintf(stderr, "error: %s_miss_latency must not be below %s_hit_latency\n",
+        name, name);
+    exit(1);
+  }
+}
+
+void check_cas_config(const cas_config &config) {
+  for(const auto &param : int_params) {
+    int value = config.*param.member;
+    if(value < param.min || value > param.max) {
+      fprintf(stderr, "error: %s must be between %d and %d\n",
+          param.name, param.min, param.max);
+      exit(1);
+    }
+    if(param.power_of_two && (value & (value-1))) {
+      fprintf(stderr, "error: %s must be a power of two\n", param.name);
+      exit(1);
+    }
+  }
+  if(!(config.clk > 0) || !(config.baudrate > 0)) {
+    fprintf(stderr, "error: clk and baudrate must be positive\n");
+    exit(1);
+  }
+  bool known_predictor = false;
+  for(int i = 0; branch_predictor_names[i]; ++i) {
+    if(config.branch_predictor == branch_predictor_names[i]) {
+      known_predictor = true;
+    }
+  }
+  if(!known_predictor) {
+    fprintf(stderr, "error: unknown branch predictor: %s\n",
+        config.branch_predictor.c_str());
+    exit(1);
+  }
+  if(config.btb_ways > config.btb_entries && config.btb_entries > 0) {
+    fprintf(stderr, "error: btb_ways must not exceed btb_entries\n");
+    exit(1);
+  }
+  check_cache_config("icache", config.icache_size, config.icache_ways,
+      config.icache_line_size, config.icache_replacement,
+      config.icache_hit_latency, config.icache_miss_latency);
+  check_cache_config("dcache", config.dcache_size, config.dcache_ways,
+      config.dcache_line_size, config.dcache_replacement,
+      config.dcache_hit_latency, config.dcache_miss_latency);
+}
+
+string cas_config_string(const cas_config &config) {
+  string ret;
+  char buf[64];
+  for(const auto &param : int_params) {
+    snprintf(buf, sizeof(buf), "%d", config.*param.member);
+    ret += string(param.name) + "=" + buf + "\n";
+  }
+  for(const auto &param : double_params) {
+    snprintf(buf, sizeof(buf), "%.17g", config.*param.member);
+    ret += string(param.name) + "=" + buf + "\n";
+  }
+  for(const auto &param : string_params) {
+    ret += string(param.name) + "=" + config.*param.member + "\n";
+  }
+  return ret;
+}
@@ -0,0 +1,97 @@
+#ifndef CAS_CONFIG_H_
+#define CAS_CONFIG_H_
+
+#include <string>
+
+// Microarchitecture parameters of the CAS model. A unit's entries are the
+// entries of its reservation station, and its ports the number of entries
+// it issues per cycle; the load/store buffer has separate entries for
+// address calculation and memory access.
+struct cas_config {
+  int rob_size;
+  // Instructions fetched, dispatched and committed per cycle.
+  int fetch_width;
+  int dispatch_width;
+  int commit_width;
+  // Results broadcast per cycle; 0 gives every issue port its own slot.
+  int cdb_width;
+  int lsbuffer_address_entries;
+  int lsbuffer_memory_entries;
+  int lsbuffer_ports;
+  // Nonzero to let loads take the data of older stores still in the
+  // load/store buffer, and to let them access memory before older stores
+  // have their addresses, replaying those that read past such a store.
+  int store_forwarding;
+  int speculative_loads;
+  int brancher_latency;
+  int brancher_entries;
+  int brancher_ports;
+  int alu_latency;
+  int alu_entries;
+  int alu_ports;
+  int fp_adder_latency;
+  int fp_adder_entries;
+  int fp_adder_ports;
+  int fp_multiplier_latency;
+  int fp_multiplier_entries;
+  int fp_multiplier_ports;
+  int fp_comparator_latency;
+  int fp_comparator_entries;
+  int fp_comparator_ports;
+  int fp_others_latency;
+  int fp_others_entries;
+  int fp_others_ports;
+  int ras_depth;
+  double clk;
+  double baudrate;
+  // One of branch_predictor_names, with its table size and the length of
+  // the global history it uses.
+  std::string branch_predictor;
+  int bp_table_entries;
+  int bp_history_length;
+  // Branch target buffer for JR/JALR other than returns; 0 disables it.
+  int btb_entries;
+  int btb_ways;
+  // Caches in front of ram; a size of 0 disables one. Sizes are in bytes,
+  // latencies in cycles from the access to the result. Without caches an
+  // instruction is fetched in 1 cycle and a memory access takes 3.
+  int icache_size;
+  int icache_ways;
+  int icache_line_size;
+  std::string icache_replacement;
+  int icache_hit_latency;
+  int icache_miss_latency;
+  int dcache_size;
+  int dcache_ways;
+  int dcache_line_size;
+  std::string dcache_replacement;
+  int dcache_hit_latency;
+  int dcache_miss_latency;
+};
+
+// Storage limits of the simulator.
+const int max_rob_size = 128;
+const int max_unit_entries = 64;
+const int max_unit_latency = 64;
+const int max_unit_ports = 4;
+const int max_pipeline_width = 8;
+const int num_units = 7;
+const int max_ras_depth = 1024;
+const int max_bp_table_entries = 1<<20;
+const int max_bp_history_length = 64;
+const int max_btb_entries = 1<<16;
+const int max_cache_size = 1<<22;
+const int max_cache_line_size = 4096;
+const int max_cache_latency = 256;
+
+extern const cas_config default_cas_config;
+
+// Reads "name = value" lines; '#' starts a comment.
+void read_cas_config(const std::string &filename, cas_config &config);
+// Applies a single "name=value" assignment.
+void set_cas_config_param(const std::string &assignment, cas_config &config);
+void check_cas_config(const cas_config &config);
+// Every parameter as a "name=value" line, in a fixed order.
+std::string cas_config_string(const cas_config &config);
+
+#endif /* CAS_CONFIG_H_ */
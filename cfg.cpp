@@ -0,0 +1,168 @@
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include "consts.h"
+#include "cfg.h"
+using namespace std;
+
+// Marks the first instruction of every basic block: the entry point,
+// branch and jump targets, the instruction after every control transfer
+// (which covers JAL/JALR return addresses) and code addresses built in a
+// register by lui/ori/addiu, which are where JR is expected to land.
+// Generated code only enters blocks at these leaders; JR anywhere else
+// has to take a slow path.
+void find_block_leaders(const vector<uint32_t> &ram, int load_pc,
+                        vector<bool> &leader) {
+  leader.assign(load_pc, false);
+  leader[0] = true;
+  bool known[32];
+  uint32_t value[32];
+  fill(known, known+32, false);
+  for(int pc = 0; pc < load_pc; ++pc) {
+    uint32_t pword = ram[pc];
+    int opcode = pword>>26;
+    int rs = (pword>>21)&31;
+    int rt = (pword>>16)&31;
+    int rd = (pword>>11)&31;
+    int funct = pword&63;
+    int fmt = rs;
+    uint32_t uimm16 = (uint16_t)pword;
+    uint32_t simm16 = (int16_t)pword;
+    int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+    bool is_transfer = false;
+    int target = -1;
+    int set_reg = 0;
+    bool set_known = false;
+    uint32_t set_value = 0;
+    switch(opcode) {
+      case OPCODE_SPECIAL:
+        if(funct == FUNCT_JR) {
+          is_transfer = true;
+        } else if(funct == FUNCT_JALR) {
+          is_transfer = true;
+          set_reg = REG_RA;
+        } else {
+          set_reg = rd;
+        }
+        break;
+      case OPCODE_J:
+      case OPCODE_JAL:
+        is_transfer = true;
+        target = jt;
+        break;
+      case OPCODE_BEQ:
+      case OPCODE_BNE:
+        is_transfer = true;
+        target = pc+1+simm16;
+        break;
+      case OPCODE_COP1:
+        if(fmt == COP1_FMT_BRANCH) {
+          is_transfer = true;
+          target = pc+1+simm16;
+        } else if(fmt == COP1_FMT_MFC1) {
+          set_reg = rt;
+        }
+        break;
+      case OPCODE_LUI:
+        set_reg = rt;
+        set_known = true;
+        set_value = uimm16<<16;
+        break;
+      case OPCODE_ORI:
+      case OPCODE_ADDIU:
+        set_reg = rt;
+        set_known = rs == REG_ZERO || known[rs];
+        set_value = rs == REG_ZERO ? 0 : value[rs];
+        if(opcode == OPCODE_ORI) {
+          set_value |= uimm16;
+        } else {
+          set_value += simm16;
+        }
+        break;
+      case OPCODE_SLTI:
+      case OPCODE_SLTIU:
+      case OPCODE_ANDI:
+      case OPCODE_XORI:
+      case OPCODE_LW:
+        set_reg = rt;
+        break;
+    }
+    if(set_reg) {
+      known[set_reg] = set_known;
+      value[set_reg] = set_value;
+      if(set_known && (set_value&3) == 0 &&
+         (set_value>>2) < (uint32_t)load_pc) {
+        leader[set_value>>2] = true;
+      }
+    }
+    if(is_transfer) {
+      if(pc+1 < load_pc) leader[pc+1] = true;
+      fill(known, known+32, false);
+    }
+    if(0 <= target && target < load_pc) leader[target] = true;
+  }
+}
+
+// Bounds for find_return_sites(). Returns reaching more call sites than
+// max_return_sites are left to the label table.
+static const int max_return_sites = 8;
+static const int max_callee_walk = 4096;
+
+// For every JR $ra, collects the return addresses of the JAL sites whose
+// callee reaches it without returning first. The return can then be
+// emitted as direct branches comparing $ra with these addresses, which the
+// host predicts far better than a jump through the label table.
+void find_return_sites(const vector<uint32_t> &ram, int load_pc,
+                       vector<vector<int>> &return_sites) {
+  vector<vector<int>> callers(load_pc);
+  for(int pc = 0; pc+1 < load_pc; ++pc) {
+    uint32_t pword = ram[pc];
+    int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+    if((pword>>26) == OPCODE_JAL && jt < load_pc) {
+      callers[jt].push_back(pc+1);
+    }
+  }
+  return_sites.assign(load_pc, vector<int>());
+  vector<int> visited(load_pc, -1);
+  for(int callee = 0; callee < load_pc; ++callee) {
+    if(callers[callee].empty()) continue;
+    vector<int> worklist(1, callee);
+    int num_visited = 0;
+    while(!worklist.empty() && num_visited < max_callee_walk) {
+      int pc = worklist.back();
+      worklist.pop_back();
+      if(pc < 0 || pc >= load_pc || visited[pc] == callee) continue;
+      visited[pc] = callee;
+      ++num_visited;
+      uint32_t pword = ram[pc];
+      int opcode = pword>>26;
+      int rs = (pword>>21)&31;
+      int funct = pword&63;
+      int fmt = rs;
+      int simm16 = (int16_t)pword;
+      int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+      if(opcode == OPCODE_SPECIAL && funct == FUNCT_JR) {
+        if(rs == REG_RA) {
+          vector<int> &sites = return_sites[pc];
+          sites.insert(sites.end(),
+                       callers[callee].begin(), callers[callee].end());
+        }
+      } else if(opcode == OPCODE_J) {
+        worklist.push_back(jt);
+      } else if(opcode == OPCODE_BEQ || opcode == OPCODE_BNE ||
+                (opcode == OPCODE_COP1 && fmt == COP1_FMT_BRANCH)) {
+        worklist.push_back(pc+1+simm16);
+        worklist.push_back(pc+1);
+      } else {
+        // JAL and JALR fall through here: the callee returns to pc+1.
+        worklist.push_back(pc+1);
+      }
+    }
+  }
+  for(vector<int> &sites : return_sites) {
+    sort(sites.begin(), sites.end());
+    sites.erase(unique(sites.begin(), sites.end()), sites.end());
+    if((int)sites.size() > max_return_sites) sites.clear();
+  }
+}
+
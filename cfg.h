@@ -0,0 +1,12 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include <cstdint>
+#include <vector>
+
+void find_block_leaders(const std::vector<uint32_t> &ram, int load_pc,
+                        std::vector<bool> &leader);
+void find_return_sites(const std::vector<uint32_t> &ram, int load_pc,
+                       std::vector<std::vector<int>> &return_sites);
+
+#endif /* CFG_H_ */
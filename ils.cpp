@@ -5,6 +5,7 @@
 #include <vector>
 #include "consts.h"
 #include "options.h"
+#include "profile.h"
 #include "ils.h"
 #include "qkfpu.h"
 using namespace std;
@@ -59,10 +60,62 @@ static void rs232c_prereceive() {
 static int64_t instruction_count_all;
 static int64_t instruction_counts[INSTRUCTION_NAME_MAX];
 static int64_t branch_counts[1<<15];
+static bool collect_profile;
+static int64_t taken_counts[1<<15];
+static int64_t not_taken_counts[1<<15];
+static branch_profile profile;
+
+// For --interval-out: the file, the instruction count the current interval
+// ends at, and the counts by type at its start.
+static FILE *interval_fp;
+static int64_t next_interval_count;
+static int64_t interval_start_count;
+static int64_t interval_start_counts[INSTRUCTION_NAME_MAX];
+
+static void start_interval() {
+  interval_start_count = instruction_count_all;
+  copy(instruction_counts, instruction_counts+INSTRUCTION_NAME_MAX,
+       interval_start_counts);
+  next_interval_count = instruction_count_all + interval_length;
+}
+
+static void open_interval_file() {
+  next_interval_count = INT64_MAX;
+  if(interval_file.empty()) return;
+  interval_fp = fopen(interval_file.c_str(), "w");
+  if(!interval_fp) {
+    fprintf(stderr, "error: cannot open %s\n", interval_file.c_str());
+    exit(1);
+  }
+  fprintf(interval_fp, "instruction,instructions");
+  for(int i = 0; i < INSTRUCTION_NAME_MAX; ++i) {
+    fprintf(interval_fp, ",%s", instnames[i]);
+  }
+  fprintf(interval_fp, "\n");
+  start_interval();
+}
+
+// Appends the instruction mix since the start of the interval, which ends
+// at the current instruction.
+static void write_interval_row() {
+  fprintf(interval_fp, "%lld,%lld", (long long int)instruction_count_all,
+      (long long int)(instruction_count_all - interval_start_count));
+  for(int i = 0; i < INSTRUCTION_NAME_MAX; ++i) {
+    fprintf(interval_fp, ",%lld",
+        (long long int)(instruction_counts[i] - interval_start_counts[i]));
+  }
+  fprintf(interval_fp, "\n");
+  fflush(interval_fp);
+  start_interval();
+}
+
 static int ils_run() {
   instruction_count_all = 0;
   fill(instruction_counts, instruction_counts+INSTRUCTION_NAME_MAX, 0);
   fill(branch_counts, branch_counts+(1<<15), 0);
+  fill(taken_counts, taken_counts+(1<<15), 0);
+  fill(not_taken_counts, not_taken_counts+(1<<15), 0);
+  open_interval_file();
   int pc = 0;
   uint32_t reg[32], freg[32];
   bool cc0 = false;
@@ -534,6 +587,13 @@ static int ils_run() {
         fprintf(stderr, "pc=0x%08x: branch not taken\n", pc*4);
       }
     }
+    if(is_branch && collect_profile) {
+      if(opcode == OPCODE_SPECIAL) {
+        ++profile.jumps[pc][branch_target];
+      } else if(opcode != OPCODE_J && opcode != OPCODE_JAL) {
+        ++(branch_success ? taken_counts : not_taken_counts)[pc];
+      }
+    }
     if(branch_success) {
       pc = branch_target;
       if(0 <= pc && pc < (1<<15)) {
@@ -543,9 +603,52 @@ static int ils_run() {
       pc = pc + 1;
     }
     ++instruction_count_all;
+    if(instruction_count_all == next_interval_count) write_interval_row();
   }
 }
 
+void show_instruction_statistics(
+    const int64_t instruction_counts[INSTRUCTION_NAME_MAX],
+    int64_t instruction_count_all,
+    const int64_t branch_counts[1<<15]) {
+  fprintf(stderr, "\n");
+  {
+    fprintf(stderr, "instruction count by types:\n");
+    vector<pair<int64_t,int>> v;
+    for(int i = 0; i < INSTRUCTION_NAME_MAX; ++i) {
+      if(instruction_counts[i]) {
+        v.emplace_back(instruction_counts[i],i);
+      }
+    }
+    sort(v.begin(), v.end());
+    reverse(v.begin(), v.end());
+    for(pair<int64_t,int> ci : v) {
+      fprintf(stderr, "%10s : %12lld\n", instnames[ci.second],
+          (long long int)ci.first);
+    }
+    fprintf(stderr, "---------------------------\n");
+    fprintf(stderr, "%10s : %12lld\n", "SUM",
+        (long long int)instruction_count_all);
+  }
+  fprintf(stderr, "\n\n");
+  fprintf(stderr, "successful branch count by targets:\n");
+  {
+    vector<pair<int64_t,int>> v;
+    for(int i = 0; i < (1<<15); ++i) {
+      if(branch_counts[i]) {
+        v.emplace_back(branch_counts[i], i);
+      }
+    }
+    sort(v.begin(), v.end());
+    reverse(v.begin(), v.end());
+    for(pair<int64_t,int> ci : v) {
+      fprintf(stderr, "0x%08x : %12lld\n", ci.second*4,
+          (long long int)ci.first);
+    }
+  }
+  fprintf(stderr, "\n");
+}
+
 void ils_main() {
   std::fill(ram,ram+(1<<20),0x55555555U);
   std::fill(ram_initialization,ram_initialization+(1<<20),false);
@@ -563,44 +666,24 @@ void ils_main() {
     ram[load_pc++] = load_pword;
   }
   for(int i = 0; i < 32; ++i) ram[load_pc++] = 0U;
+  collect_profile = !profile_output_file.empty();
   int retval = ils_run();
-  if(show_statistics) {
-    fprintf(stderr, "\n");
-    {
-      fprintf(stderr, "instruction count by types:\n");
-      vector<pair<int64_t,int>> v;
-      for(int i = 0; i < INSTRUCTION_NAME_MAX; ++i) {
-        if(instruction_counts[i]) {
-          v.emplace_back(instruction_counts[i],i);
-        }
-      }
-      sort(v.begin(), v.end());
-      reverse(v.begin(), v.end());
-      for(pair<int64_t,int> ci : v) {
-        fprintf(stderr, "%10s : %12lld\n", instnames[ci.second],
-            (long long int)ci.first);
-      }
-      fprintf(stderr, "---------------------------\n");
-      fprintf(stderr, "%10s : %12lld\n", "SUM",
-          (long long int)instruction_count_all);
-    }
-    fprintf(stderr, "\n\n");
-    fprintf(stderr, "successful branch count by targets:\n");
-    {
-      vector<pair<int64_t,int>> v;
-      for(int i = 0; i < (1<<15); ++i) {
-        if(branch_counts[i]) {
-          v.emplace_back(branch_counts[i], i);
-        }
-      }
-      sort(v.begin(), v.end());
-      reverse(v.begin(), v.end());
-      for(pair<int64_t,int> ci : v) {
-        fprintf(stderr, "0x%08x : %12lld\n", ci.second*4,
-            (long long int)ci.first);
+  if(interval_fp) {
+    if(instruction_count_all > interval_start_count) write_interval_row();
+    fclose(interval_fp);
+  }
+  if(collect_profile) {
+    for(int pc = 0; pc < (1<<15); ++pc) {
+      if(taken_counts[pc] || not_taken_counts[pc]) {
+        profile.branches[pc] = make_pair(taken_counts[pc],
+                                         not_taken_counts[pc]);
       }
     }
-    fprintf(stderr, "\n");
+    write_branch_profile(profile_output_file, profile);
+  }
+  if(show_statistics) {
+    show_instruction_statistics(instruction_counts, instruction_count_all,
+                                branch_counts);
   }
   exit(retval);
 }
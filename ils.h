@@ -1,6 +1,13 @@
 #ifndef ILS_H_
 #define ILS_H_
 
+#include <cstdint>
+#include "consts.h"
+
 void ils_main(void);
+void show_instruction_statistics(
+    const int64_t instruction_counts[INSTRUCTION_NAME_MAX],
+    int64_t instruction_count_all,
+    const int64_t branch_counts[1<<15]);
 
 #endif /* ILS_H_ */
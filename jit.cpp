@@ -1,10 +1,11 @@
 #include <cstdlib>
 #include <cstdint>
+#include <cstdio>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <sys/wait.h>
 #include <algorithm>
+#include <array>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -13,6 +14,9 @@
 #include <iomanip>
 #include "consts.h"
 #include "options.h"
+#include "ils.h"
+#include "cfg.h"
+#include "profile.h"
 #include "jit.h"
 using namespace std;
 
@@ -46,7 +50,539 @@ inline string hex_repr(uint32_t i) {
   return o.str();
 }
 
+// With --native-fp, FP instructions are emitted as host float arithmetic
+// on bit-cast registers so that gcc can schedule them like integer code.
+// Otherwise they call the soft-FPU.
+inline string fp_binary(const string &soft_fun, const string &op,
+                        const string &fs, const string &ft) {
+  if(use_native_fp) {
+    return "as_word(as_float(" + fs + ") " + op + " as_float(" + ft + "))";
+  }
+  return soft_fun + "(" + fs + ", " + ft + ")";
+}
+
+inline string fp_compare(const string &soft_fun, const string &op,
+                         const string &fs, const string &ft) {
+  if(use_native_fp) {
+    return "(as_float(" + fs + ") " + op + " as_float(" + ft + "))";
+  }
+  return soft_fun + "(" + fs + ", " + ft + ")";
+}
+
+// Bounds for the use of --profile-in. A conditional branch gets a
+// __builtin_expect hint when one direction was taken at least
+// min_branch_bias times as often as the other, and JR compares against at
+// most max_profiled_targets of its observed targets before falling back to
+// the label table.
+static const int64_t min_branch_bias = 4;
+static const int max_profiled_targets = 4;
+
+inline string expect_repr(const branch_profile &profile, int pc,
+                          const string &cond) {
+  auto it = profile.branches.find(pc);
+  if(it == profile.branches.end()) return cond;
+  int64_t taken = it->second.first;
+  int64_t not_taken = it->second.second;
+  if(taken >= min_branch_bias * not_taken && taken > 0) {
+    return "__builtin_expect(!!(" + cond + "), 1)";
+  }
+  if(not_taken >= min_branch_bias * taken && not_taken > 0) {
+    return "__builtin_expect(!!(" + cond + "), 0)";
+  }
+  return cond;
+}
+
+// Returns the most frequent targets of the JR/JALR at pc in the profile.
+static vector<int> profiled_targets(const branch_profile &profile, int pc,
+                                    int load_pc) {
+  vector<pair<int64_t,int>> v;
+  auto it = profile.jumps.find(pc);
+  if(it != profile.jumps.end()) {
+    for(const auto &target : it->second) {
+      if(0 <= target.first && target.first < load_pc) {
+        v.emplace_back(target.second, target.first);
+      }
+    }
+  }
+  sort(v.begin(), v.end());
+  reverse(v.begin(), v.end());
+  vector<int> targets;
+  for(int i = 0; i < (int)v.size() && i < max_profiled_targets; ++i) {
+    targets.push_back(v[i].second);
+  }
+  return targets;
+}
+
+static const char statistics_file[] = "tmp-qksim-statistics.dat";
+static const char image_file[] = "tmp-qksim-image.bin";
+
+// Classifies an instruction the same way ils_run() counts it, or returns
+// -1 for an undecodable word.
+static int instruction_name(uint32_t pword) {
+  int opcode = pword>>26;
+  int rs = (pword>>21)&31;
+  int rt = (pword>>16)&31;
+  int rd = (pword>>11)&31;
+  int funct = pword&63;
+  int fmt = rs;
+  switch(opcode) {
+    case OPCODE_SPECIAL:
+      switch(funct) {
+        case FUNCT_SLL:
+          return rd == 0 ? INSTRUCTION_NAME_NOP : INSTRUCTION_NAME_SLL;
+        case FUNCT_SRL:  return INSTRUCTION_NAME_SRL;
+        case FUNCT_SRA:  return INSTRUCTION_NAME_SRA;
+        case FUNCT_SLLV: return INSTRUCTION_NAME_SLLV;
+        case FUNCT_SRLV: return INSTRUCTION_NAME_SRLV;
+        case FUNCT_SRAV: return INSTRUCTION_NAME_SRAV;
+        case FUNCT_JR:   return INSTRUCTION_NAME_JR;
+        case FUNCT_JALR: return INSTRUCTION_NAME_JALR;
+        case FUNCT_ADDU: return INSTRUCTION_NAME_ADDU;
+        case FUNCT_SUBU: return INSTRUCTION_NAME_SUBU;
+        case FUNCT_AND:  return INSTRUCTION_NAME_AND;
+        case FUNCT_OR:   return INSTRUCTION_NAME_OR;
+        case FUNCT_XOR:  return INSTRUCTION_NAME_XOR;
+        case FUNCT_NOR:  return INSTRUCTION_NAME_NOR;
+        case FUNCT_SLT:  return INSTRUCTION_NAME_SLT;
+        case FUNCT_SLTU: return INSTRUCTION_NAME_SLTU;
+      }
+      return -1;
+    case OPCODE_J:     return INSTRUCTION_NAME_J;
+    case OPCODE_JAL:   return INSTRUCTION_NAME_JAL;
+    case OPCODE_BEQ:   return INSTRUCTION_NAME_BEQ;
+    case OPCODE_BNE:   return INSTRUCTION_NAME_BNE;
+    case OPCODE_ADDIU:
+      return rs == 0 ? INSTRUCTION_NAME_LI_SMALL : INSTRUCTION_NAME_ADDIU;
+    case OPCODE_SLTI:  return INSTRUCTION_NAME_SLTI;
+    case OPCODE_SLTIU: return INSTRUCTION_NAME_SLTIU;
+    case OPCODE_ANDI:  return INSTRUCTION_NAME_ANDI;
+    case OPCODE_ORI:   return INSTRUCTION_NAME_ORI;
+    case OPCODE_XORI:  return INSTRUCTION_NAME_XORI;
+    case OPCODE_LUI:   return INSTRUCTION_NAME_LUI;
+    case OPCODE_LW:    return INSTRUCTION_NAME_LW;
+    case OPCODE_SW:    return INSTRUCTION_NAME_SW;
+    case OPCODE_LWC1:  return INSTRUCTION_NAME_LWC1;
+    case OPCODE_SWC1:  return INSTRUCTION_NAME_SWC1;
+    case OPCODE_COP1:
+      switch(fmt) {
+        case COP1_FMT_BRANCH:
+          if(rt == 0) return INSTRUCTION_NAME_FP_BC1F;
+          if(rt == 1) return INSTRUCTION_NAME_FP_BC1T;
+          return -1;
+        case COP1_FMT_MFC1: return INSTRUCTION_NAME_FP_MFC1;
+        case COP1_FMT_MTC1: return INSTRUCTION_NAME_FP_MTC1;
+        case COP1_FMT_S:
+          switch(funct) {
+            case COP1_FUNCT_ADD:   return INSTRUCTION_NAME_FP_ADD_S;
+            case COP1_FUNCT_SUB:   return INSTRUCTION_NAME_FP_SUB_S;
+            case COP1_FUNCT_MUL:   return INSTRUCTION_NAME_FP_MUL_S;
+            case COP1_FUNCT_DIV:   return INSTRUCTION_NAME_FP_DIV_S;
+            case COP1_FUNCT_SQRT:  return INSTRUCTION_NAME_FP_SQRT_S;
+            case COP1_FUNCT_MOV:   return INSTRUCTION_NAME_FP_MOV_S;
+            case COP1_FUNCT_CVT_W: return INSTRUCTION_NAME_FP_CVT_W_S;
+            case COP1_FUNCT_C_EQ:  return INSTRUCTION_NAME_FP_C_EQ_S;
+            case COP1_FUNCT_C_OLT: return INSTRUCTION_NAME_FP_C_OLT_S;
+            case COP1_FUNCT_C_OLE: return INSTRUCTION_NAME_FP_C_OLE_S;
+          }
+          return -1;
+        case COP1_FMT_W:
+          if(funct == COP1_FUNCT_CVT_S) return INSTRUCTION_NAME_FP_CVT_S_W;
+          return -1;
+      }
+      return -1;
+  }
+  return -1;
+}
+
+// Rebuilds the counters of ils_run() from the block, taken-branch,
+// jump-target and slow-path counters dumped by the compiled program, and
+// prints them.
+static void show_jit_statistics(const vector<uint32_t> &ram, int load_pc,
+                                const vector<bool> &leader) {
+  int32_t halt_pc;
+  vector<int64_t> block_counts(load_pc);
+  vector<int64_t> taken_counts(load_pc);
+  vector<int64_t> jump_counts(load_pc);
+  vector<int64_t> slow_counts(load_pc);
+  FILE *fp = fopen(statistics_file, "rb");
+  bool read_success =
+    fp &&
+    fread(&halt_pc, sizeof(halt_pc), 1, fp) == 1 &&
+    fread(block_counts.data(), sizeof(int64_t), load_pc, fp) ==
+      (size_t)load_pc &&
+    fread(taken_counts.data(), sizeof(int64_t), load_pc, fp) ==
+      (size_t)load_pc &&
+    fread(jump_counts.data(), sizeof(int64_t), load_pc, fp) ==
+      (size_t)load_pc &&
+    fread(slow_counts.data(), sizeof(int64_t), load_pc, fp) ==
+      (size_t)load_pc;
+  if(fp) fclose(fp);
+  if(!read_success) {
+    fprintf(stderr, "error: cannot read %s\n", statistics_file);
+    return;
+  }
+  vector<int64_t> instruction_counts(INSTRUCTION_NAME_MAX, 0);
+  vector<int64_t> branch_counts(1<<15, 0);
+  int64_t instruction_count_all = 0;
+  int64_t native_count = 0;
+  for(int pc = 0; pc < load_pc; ++pc) {
+    // Compiled code enters a block only at its leader and leaves it only at
+    // its end or where the program halted. Everything else ran in the slow
+    // path, which counts instructions and taken branches by itself.
+    if(leader[pc]) native_count = block_counts[pc];
+    if(pc == halt_pc) --native_count;
+    int64_t count = native_count + slow_counts[pc];
+    uint32_t pword = ram[pc];
+    int opcode = pword>>26;
+    int rs = (pword>>21)&31;
+    int fmt = rs;
+    int simm16 = (int16_t)pword;
+    int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+    int name = instruction_name(pword);
+    if(name >= 0) instruction_counts[name] += count;
+    instruction_count_all += count;
+    int target = -1;
+    int64_t taken = 0;
+    if(opcode == OPCODE_J || opcode == OPCODE_JAL) {
+      target = jt;
+      taken = native_count;
+    } else if(opcode == OPCODE_BEQ || opcode == OPCODE_BNE ||
+              (opcode == OPCODE_COP1 && fmt == COP1_FMT_BRANCH)) {
+      target = pc+1+simm16;
+      taken = taken_counts[pc];
+    }
+    if(0 <= target && target < (1<<15)) branch_counts[target] += taken;
+  }
+  for(int pc = 0; pc < load_pc && pc < (1<<15); ++pc) {
+    branch_counts[pc] += jump_counts[pc];
+  }
+  show_instruction_statistics(instruction_counts.data(),
+                              instruction_count_all, branch_counts.data());
+}
+
+// Finds registers that never hold an address with the MSB set.
+// Memory-mapped I/O lives at 0xFFFF0000-0xFFFF000C, which no such base can
+// reach with a 16-bit signed offset, so accesses through these registers
+// can skip the I/O check. Pointer arithmetic (addiu) is assumed not to
+// wrap around, i.e. the guest stack and heap stay inside RAM.
+static void find_ram_pointers(const vector<uint32_t> &ram, int load_pc,
+                              bool ram_pointer[32]) {
+  fill(ram_pointer, ram_pointer+32, true);
+  for(bool changed = true; changed; ) {
+    changed = false;
+    for(int pc = 0; pc < load_pc; ++pc) {
+      uint32_t pword = ram[pc];
+      int opcode = pword>>26;
+      int rs = (pword>>21)&31;
+      int rt = (pword>>16)&31;
+      int rd = (pword>>11)&31;
+      int sa = (pword>> 6)&31;
+      int funct = pword&63;
+      int fmt = rs;
+      uint32_t uimm16 = (uint16_t)pword;
+      int set_reg = 0;
+      bool is_pointer = false;
+      switch(opcode) {
+        case OPCODE_SPECIAL:
+          set_reg = rd;
+          if(funct == FUNCT_ADDU || funct == FUNCT_OR) {
+            is_pointer =
+              (rs == REG_ZERO && ram_pointer[rt]) ||
+              (rt == REG_ZERO && ram_pointer[rs]);
+          } else if(funct == FUNCT_SRL) {
+            is_pointer = sa > 0 || ram_pointer[rt];
+          } else if(funct == FUNCT_SLT || funct == FUNCT_SLTU) {
+            is_pointer = true;
+          } else if(funct == FUNCT_JR) {
+            set_reg = 0;
+          } else if(funct == FUNCT_JALR) {
+            set_reg = REG_RA;
+            is_pointer = true;
+          }
+          break;
+        case OPCODE_JAL:
+          set_reg = REG_RA;
+          is_pointer = true;
+          break;
+        case OPCODE_ADDIU:
+          set_reg = rt;
+          if(rs == REG_ZERO) {
+            is_pointer = (int16_t)pword >= 0;
+          } else {
+            is_pointer = ram_pointer[rs];
+          }
+          break;
+        case OPCODE_ORI:
+          set_reg = rt;
+          is_pointer = ram_pointer[rs];
+          break;
+        case OPCODE_SLTI:
+        case OPCODE_SLTIU:
+        case OPCODE_ANDI:
+          set_reg = rt;
+          is_pointer = true;
+          break;
+        case OPCODE_XORI:
+        case OPCODE_LW:
+          set_reg = rt;
+          break;
+        case OPCODE_LUI:
+          set_reg = rt;
+          is_pointer = uimm16 < 0x8000;
+          break;
+        case OPCODE_COP1:
+          if(fmt == COP1_FMT_MFC1) set_reg = rt;
+          break;
+      }
+      if(set_reg && !is_pointer && ram_pointer[set_reg]) {
+        ram_pointer[set_reg] = false;
+        changed = true;
+      }
+    }
+  }
+}
+
+inline string load_repr(bool direct, const string &base, uint32_t offset) {
+  string addr = base + " + " + hex_repr(offset);
+  if(direct) return "ram[(" + addr + ")>>2]";
+  return "load_word(" + addr + ")";
+}
+
+inline string store_repr(bool direct, const string &base, uint32_t offset,
+                         const string &val) {
+  string addr = base + " + " + hex_repr(offset);
+  if(direct) return "ram[(" + addr + ")>>2] = " + val;
+  return "store_word(" + addr + ", " + val + ")";
+}
+
+// What is known about a guest register at some point of a block.
+// Registers are numbered 0-31 for $zero-$ra and 32-63 for $f0-$f31.
+struct reg_fact {
+  enum { UNKNOWN, CONSTANT, COPY } kind;
+  uint32_t value;  // the constant, or the register holding the same value
+};
+typedef array<reg_fact, 64> reg_facts;
+
+// Register operands of an instruction, as used by the dataflow pass. def
+// is 0 if no register is written; pure instructions have no effect other
+// than writing def.
+static void instruction_operands(uint32_t pword, int &def, int uses[3],
+                                 int &num_uses, bool &pure) {
+  int opcode = pword>>26;
+  int rs = (pword>>21)&31;
+  int rt = (pword>>16)&31;
+  int rd = (pword>>11)&31;
+  int funct = pword&63;
+  int fmt = rs;
+  def = 0;
+  num_uses = 0;
+  pure = false;
+  switch(opcode) {
+    case OPCODE_SPECIAL:
+      if(funct == FUNCT_JR) {
+        uses[num_uses++] = rs;
+      } else if(funct == FUNCT_JALR) {
+        uses[num_uses++] = rs;
+        def = REG_RA;
+      } else if(instruction_name(pword) >= 0) {
+        if(funct >= FUNCT_SLLV) uses[num_uses++] = rs;
+        uses[num_uses++] = rt;
+        def = rd;
+        pure = true;
+      }
+      break;
+    case OPCODE_JAL:
+      def = REG_RA;
+      break;
+    case OPCODE_BEQ:
+    case OPCODE_BNE:
+      uses[num_uses++] = rs;
+      uses[num_uses++] = rt;
+      break;
+    case OPCODE_ADDIU:
+    case OPCODE_SLTI:
+    case OPCODE_SLTIU:
+    case OPCODE_ANDI:
+    case OPCODE_ORI:
+    case OPCODE_XORI:
+      uses[num_uses++] = rs;
+      def = rt;
+      pure = true;
+      break;
+    case OPCODE_LUI:
+      def = rt;
+      pure = true;
+      break;
+    case OPCODE_LW:
+    case OPCODE_LWC1:
+      uses[num_uses++] = rs;
+      def = opcode == OPCODE_LW ? rt : 32+rt;
+      break;
+    case OPCODE_SW:
+    case OPCODE_SWC1:
+      uses[num_uses++] = rs;
+      uses[num_uses++] = opcode == OPCODE_SW ? rt : 32+rt;
+      break;
+    case OPCODE_COP1:
+      if(instruction_name(pword) < 0) break;
+      if(fmt == COP1_FMT_MFC1) {
+        uses[num_uses++] = 32+rd;
+        def = rt;
+        pure = true;
+      } else if(fmt == COP1_FMT_MTC1) {
+        uses[num_uses++] = rt;
+        def = 32+rd;
+        pure = true;
+      } else if(fmt == COP1_FMT_S || fmt == COP1_FMT_W) {
+        uses[num_uses++] = 32+rd;
+        if(fmt == COP1_FMT_S && funct != COP1_FUNCT_SQRT &&
+           funct != COP1_FUNCT_MOV && funct != COP1_FUNCT_CVT_W) {
+          uses[num_uses++] = 32+rt;
+        }
+        // Comparisons write cc0, which is not tracked.
+        if(funct < COP1_FUNCT_C_EQ) {
+          def = 32+((pword>>6)&31);
+          pure = true;
+        }
+      }
+      break;
+  }
+}
+
+inline string operand_repr(const reg_facts &facts, int r) {
+  if(r == REG_ZERO) return "0U";
+  const reg_fact &fact = facts[r];
+  if(fact.kind == reg_fact::CONSTANT) return hex_repr(fact.value) + "U";
+  if(fact.kind == reg_fact::COPY) r = fact.value;
+  if(r == REG_ZERO) return "0U";
+  return r < 32 ? regnames[r] : fregnames[r-32];
+}
+
+// Constant and copy propagation followed by dead-write elimination within
+// each block. facts[pc] describes the registers before the instruction at
+// pc and results[pc] what it writes; dead[pc] is set when its result is
+// overwritten in the same block before being read. Every register is
+// assumed live at the end of a block.
+static void analyze_dataflow(const vector<uint32_t> &ram, int load_pc,
+                             const vector<bool> &leader,
+                             vector<reg_facts> &facts,
+                             vector<reg_fact> &results, vector<bool> &dead) {
+  reg_facts state;
+  for(reg_fact &fact : state) fact.kind = reg_fact::UNKNOWN;
+  facts.assign(load_pc, state);
+  results.assign(load_pc, state[0]);
+  dead.assign(load_pc, false);
+  if(show_commit_log) return;
+  for(int pc = 0; pc < load_pc; ++pc) {
+    if(leader[pc]) {
+      for(reg_fact &fact : state) fact.kind = reg_fact::UNKNOWN;
+    }
+    facts[pc] = state;
+    uint32_t pword = ram[pc];
+    int def, uses[3], num_uses;
+    bool pure;
+    instruction_operands(pword, def, uses, num_uses, pure);
+    if(!def) continue;
+    int opcode = pword>>26;
+    int rs = (pword>>21)&31;
+    int rt = (pword>>16)&31;
+    int rd = (pword>>11)&31;
+    int sa = (pword>> 6)&31;
+    int funct = pword&63;
+    int fmt = rs;
+    uint32_t uimm16 = (uint16_t)pword;
+    uint32_t simm16 = (int16_t)pword;
+    // Resolve a register to what it is known to hold.
+    auto resolve = [&](int r) {
+      reg_fact fact;
+      if(r == REG_ZERO) {
+        fact.kind = reg_fact::CONSTANT;
+        fact.value = 0;
+      } else if(state[r].kind != reg_fact::UNKNOWN) {
+        fact = state[r];
+      } else {
+        fact.kind = reg_fact::COPY;
+        fact.value = r;
+      }
+      return fact;
+    };
+    reg_fact a = resolve(rs), b = resolve(rt);
+    bool a_const = a.kind == reg_fact::CONSTANT;
+    bool b_const = b.kind == reg_fact::CONSTANT;
+    reg_fact result;
+    result.kind = reg_fact::UNKNOWN;
+    if(opcode == OPCODE_SPECIAL && funct == FUNCT_SLL) {
+      if(b_const) {
+        result.kind = reg_fact::CONSTANT;
+        result.value = b.value << sa;
+      } else if(sa == 0) {
+        result = b;
+      }
+    } else if(opcode == OPCODE_SPECIAL &&
+              (funct == FUNCT_ADDU || funct == FUNCT_OR)) {
+      if(a_const && b_const) {
+        result.kind = reg_fact::CONSTANT;
+        result.value =
+          funct == FUNCT_ADDU ? a.value + b.value : a.value | b.value;
+      } else if(a_const && a.value == 0) {
+        result = b;
+      } else if(b_const && b.value == 0) {
+        result = a;
+      }
+    } else if(opcode == OPCODE_LUI) {
+      result.kind = reg_fact::CONSTANT;
+      result.value = uimm16 << 16;
+    } else if(a_const && (opcode == OPCODE_ADDIU || opcode == OPCODE_ORI ||
+                          opcode == OPCODE_ANDI || opcode == OPCODE_XORI)) {
+      result.kind = reg_fact::CONSTANT;
+      if(opcode == OPCODE_ADDIU) result.value = a.value + simm16;
+      if(opcode == OPCODE_ORI) result.value = a.value | uimm16;
+      if(opcode == OPCODE_ANDI) result.value = a.value & uimm16;
+      if(opcode == OPCODE_XORI) result.value = a.value ^ uimm16;
+    } else if(opcode == OPCODE_ADDIU && simm16 == 0) {
+      result = a;
+    } else if(opcode == OPCODE_COP1 && fmt == COP1_FMT_MFC1) {
+      result = resolve(32+rd);
+    } else if(opcode == OPCODE_COP1 && fmt == COP1_FMT_MTC1) {
+      result = b;
+    } else if(opcode == OPCODE_COP1 && fmt == COP1_FMT_S &&
+              funct == COP1_FUNCT_MOV) {
+      result = resolve(32+rd);
+    }
+    if(result.kind == reg_fact::COPY && (int)result.value == def) continue;
+    for(reg_fact &fact : state) {
+      if(fact.kind == reg_fact::COPY && (int)fact.value == def) {
+        fact.kind = reg_fact::UNKNOWN;
+      }
+    }
+    state[def] = result;
+    results[pc] = result;
+  }
+  bool live[64];
+  for(int pc = load_pc-1; pc >= 0; --pc) {
+    if(pc+1 == load_pc || leader[pc+1]) fill(live, live+64, true);
+    int def, uses[3], num_uses;
+    bool pure;
+    instruction_operands(ram[pc], def, uses, num_uses, pure);
+    if(pure && def && !live[def]) {
+      dead[pc] = true;
+      continue;
+    }
+    if(def) live[def] = false;
+    for(int i = 0; i < num_uses; ++i) {
+      int r = uses[i];
+      const reg_fact &fact = facts[pc][r];
+      if(fact.kind == reg_fact::CONSTANT) continue;
+      if(fact.kind == reg_fact::COPY) r = fact.value;
+      live[r] = true;
+    }
+  }
+}
+
 void jit_main() {
+  // The compiled program inherits fd 0 and reads the input that follows
+  // the program image directly, so the loader must not read ahead.
+  setvbuf(stdin, nullptr, _IONBF, 0);
   vector<uint32_t> ram(1<<20);
   int load_pc = 0;
   for(;;) {
@@ -61,22 +597,29 @@ void jit_main() {
     ram[load_pc++] = load_pword;
   }
   for(int i = 0; i < 32; ++i) ram[load_pc++] = 0U;
-  {
-    ofstream intmp("tmp-qksim-input.dat");
-    for(;;) {
-      unsigned char ch;
-      size_t readsize = fread(&ch,1,1,stdin);
-      if(readsize<1) {
-        if(feof(stdin)) {
-          break;
-        } else {
-          fprintf(stderr, "input error\n");
-          exit(1);
+  bool ram_pointer[32];
+  find_ram_pointers(ram, load_pc, ram_pointer);
+  vector<vector<int>> return_sites;
+  find_return_sites(ram, load_pc, return_sites);
+  vector<bool> leader;
+  find_block_leaders(ram, load_pc, leader);
+  branch_profile profile;
+  if(!profile_input_file.empty()) {
+    read_branch_profile(profile_input_file, profile);
+    // Give observed JR targets a label of their own, so that they do not
+    // take the slow path.
+    for(const auto &jump : profile.jumps) {
+      for(const auto &target : jump.second) {
+        if(0 <= target.first && target.first < load_pc) {
+          leader[target.first] = true;
         }
       }
-      intmp << ch;
     }
   }
+  vector<reg_facts> facts;
+  vector<reg_fact> results;
+  vector<bool> dead;
+  analyze_dataflow(ram, load_pc, leader, facts, results, dead);
 
   ostringstream prologue;
   ostringstream body;
@@ -84,16 +627,72 @@ void jit_main() {
   prologue << "#include <stdio.h>" << endl;
   prologue << "#include <stdlib.h>" << endl;
   prologue << "#include <stdint.h>" << endl;
+  prologue << "#include <string.h>" << endl;
+  prologue << "#include <math.h>" << endl;
   prologue << "#include \"qkfpu.h\"" << endl;
   prologue << "" << endl;
-  prologue << "uint32_t ram[1<<20] = {" << endl;
-  for(int i = 0; i < load_pc; ++i) {
-    prologue << "  " << hex_repr(ram[i]);
-    if(i < load_pc+1) prologue << ", ";
-    prologue << endl;
+  if(use_native_fp) {
+    prologue << "static inline float as_float(uint32_t u) {" << endl;
+    prologue << "  float f;" << endl;
+    prologue << "  memcpy(&f, &u, sizeof(f));" << endl;
+    prologue << "  return f;" << endl;
+    prologue << "}" << endl;
+    prologue << "" << endl;
+    prologue << "static inline uint32_t as_word(float f) {" << endl;
+    prologue << "  uint32_t u;" << endl;
+    prologue << "  memcpy(&u, &f, sizeof(u));" << endl;
+    prologue << "  return u;" << endl;
+    prologue << "}" << endl;
+    prologue << "" << endl;
   }
-  prologue << "};" << endl;
+  // The program image is not spelled out as a C initializer, which gcc
+  // would have to parse. It is assembled in as a binary blob and copied
+  // into ram at startup.
+  {
+    FILE *fp = fopen(image_file, "wb");
+    if(!fp ||
+       fwrite(ram.data(), sizeof(uint32_t), load_pc, fp) != (size_t)load_pc) {
+      fprintf(stderr, "error: cannot write %s\n", image_file);
+      exit(1);
+    }
+    fclose(fp);
+  }
+  prologue << "uint32_t ram[1<<20];" << endl;
+  prologue << "extern const uint32_t ram_image[" << dec_repr(load_pc) << "];"
+    << endl;
+  prologue << "__asm__(" << endl;
+  prologue << "  \".section .rodata\\n\"" << endl;
+  prologue << "  \".balign 4\\n\"" << endl;
+  prologue << "  \".globl ram_image\\n\"" << endl;
+  prologue << "  \"ram_image:\\n\"" << endl;
+  prologue << "  \".incbin \\\"" << image_file << "\\\"\\n\"" << endl;
+  prologue << "  \".previous\\n\");" << endl;
   prologue << "" << endl;
+  if(show_statistics) {
+    prologue << "int64_t block_counts[" << dec_repr(load_pc) << "];" << endl;
+    prologue << "int64_t taken_counts[" << dec_repr(load_pc) << "];" << endl;
+    prologue << "int64_t jump_counts[" << dec_repr(load_pc) << "];" << endl;
+    prologue << "int64_t slow_counts[" << dec_repr(load_pc) << "];" << endl;
+    prologue << "int32_t current_pc = -1;" << endl;
+    prologue << "int32_t halt_pc = -1;" << endl;
+    prologue << "" << endl;
+    prologue << "void dump_statistics(void) {" << endl;
+    prologue << "  FILE *fp = fopen(\"" << statistics_file << "\", \"wb\");"
+      << endl;
+    prologue << "  if(!fp) return;" << endl;
+    prologue << "  fwrite(&halt_pc, sizeof(halt_pc), 1, fp);" << endl;
+    prologue << "  fwrite(block_counts, sizeof(int64_t), "
+      << dec_repr(load_pc) << ", fp);" << endl;
+    prologue << "  fwrite(taken_counts, sizeof(int64_t), "
+      << dec_repr(load_pc) << ", fp);" << endl;
+    prologue << "  fwrite(jump_counts, sizeof(int64_t), "
+      << dec_repr(load_pc) << ", fp);" << endl;
+    prologue << "  fwrite(slow_counts, sizeof(int64_t), "
+      << dec_repr(load_pc) << ", fp);" << endl;
+    prologue << "  fclose(fp);" << endl;
+    prologue << "}" << endl;
+    prologue << "" << endl;
+  }
   // prologue << "inline uint32_t load_word(uint32_t addr) {" << endl;
   prologue << "uint32_t load_word(uint32_t addr) {" << endl;
   prologue << "  if(addr & 0x80000000) {" << endl;
@@ -101,9 +700,15 @@ void jit_main() {
   prologue << "      return 1;" << endl;
   prologue << "    }" << endl;
   prologue << "    if(addr == 0xFFFF0004U) {" << endl;
-  prologue << "      unsigned char ch;" << endl;
-  prologue << "      size_t readsize = fread(&ch,1,1,stdin);" << endl;
-  prologue << "      if(readsize<1) exit(0);" << endl;
+  prologue << "      int ch = getchar();" << endl;
+  if(show_statistics) {
+    prologue << "      if(ch == EOF) {" << endl;
+    prologue << "        halt_pc = current_pc;" << endl;
+    prologue << "        exit(0);" << endl;
+    prologue << "      }" << endl;
+  } else {
+    prologue << "      if(ch == EOF) exit(0);" << endl;
+  }
   prologue << "      return ch;" << endl;
   prologue << "    }" << endl;
   prologue << "    if(addr == 0xFFFF0008U) {" << endl;
@@ -112,6 +717,7 @@ void jit_main() {
   prologue << "  } else {" << endl;
   prologue << "    return ram[addr>>2];" << endl;
   prologue << "  }" << endl;
+  prologue << "  return 0;" << endl;
   prologue << "}" << endl;
   prologue << "" << endl;
   // prologue << "inline void store_word(uint32_t addr, uint32_t val) {" << endl;
@@ -126,6 +732,12 @@ void jit_main() {
   prologue << "  }" << endl;
   prologue << "}" << endl;
   prologue << "" << endl;
+  if(use_native_fp) prologue << "#define QKSIM_NATIVE_FP" << endl;
+  if(show_statistics) prologue << "#define QKSIM_STATISTICS" << endl;
+  if(show_commit_log) prologue << "#define QKSIM_COMMIT_LOG" << endl;
+  prologue << "#include \"consts.h\"" << endl;
+  prologue << "#include \"jit_slowpath.h\"" << endl;
+  prologue << "" << endl;
   prologue << "int main() {" << endl;
   for(int i = 1; i < 32; ++i) {
     prologue << "  uint32_t " << regnames[i] << " = 0U;" << endl;
@@ -134,20 +746,55 @@ void jit_main() {
     prologue << "  uint32_t " << fregnames[i] << " = 0U;" << endl;
   }
   prologue << "  int cc0 = 0;" << endl;
+  prologue << "  memcpy(ram, ram_image, sizeof(ram_image));" << endl;
+  prologue << "  uint32_t npc;" << endl;
+  if(show_statistics) {
+    prologue << "  atexit(dump_statistics);" << endl;
+  }
   epilogue << "  return 0;" << endl;
+  // JR to an instruction that is not a block leader: run it in the
+  // interpreter of jit_slowpath.h until control reaches a leader again.
+  epilogue << "Lslow: {" << endl;
+  epilogue << "  uint32_t reg[32], freg[32];" << endl;
+  epilogue << "  reg[0] = 0U;" << endl;
+  for(int i = 1; i < 32; ++i) {
+    epilogue << "  reg[" << i << "] = " << regnames[i] << ";" << endl;
+  }
+  for(int i = 0; i < 32; ++i) {
+    epilogue << "  freg[" << i << "] = " << fregnames[i] << ";" << endl;
+  }
+  epilogue << "  npc = run_slow_path(reg, freg, &cc0, npc, labels, &&Lslow, "
+    << dec_repr(load_pc) << ");" << endl;
+  for(int i = 1; i < 32; ++i) {
+    epilogue << "  " << regnames[i] << " = reg[" << i << "];" << endl;
+  }
+  for(int i = 0; i < 32; ++i) {
+    epilogue << "  " << fregnames[i] << " = freg[" << i << "];" << endl;
+  }
+  epilogue << "  goto *labels[npc];" << endl;
+  epilogue << "}" << endl;
   epilogue << "}" << endl;
 
   prologue << "  static const void *labels[" << dec_repr(load_pc) << "] = {"
     << endl;
   for(int pc = 0; pc < load_pc; ++pc) {
-    prologue << "    && L" << hex_repr(pc*4);
+    if(leader[pc]) {
+      prologue << "    && L" << hex_repr(pc*4);
+    } else {
+      prologue << "    && Lslow";
+    }
     if(pc < load_pc-1) prologue << ",";
     prologue << endl;
   }
   prologue << "  };" << endl;
 
   for(int pc = 0; pc < load_pc; ++pc) {
-    body << "L" << hex_repr(pc*4) << ":" << endl;
+    if(leader[pc]) {
+      body << "L" << hex_repr(pc*4) << ":" << endl;
+      if(show_statistics) {
+        body << "  ++block_counts[" << dec_repr(pc) << "];" << endl;
+      }
+    }
     // body << "  fprintf(stderr, \"pc = " << hex_repr(pc*4) << "\\n\");" << endl;
     uint32_t pword = ram[pc];
     int opcode = pword>>26;
@@ -163,6 +810,7 @@ void jit_main() {
     uint32_t uimm16 = (uint16_t)pword;
     uint32_t simm16 = (int16_t)pword;
     int jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+    auto src = [&](int r) { return operand_repr(facts[pc], r); };
     string branch_cond;
     int branch_target = -1;
     bool jump_success = false;
@@ -178,32 +826,32 @@ void jit_main() {
         switch(funct) {
           case FUNCT_SLL:
             set_reg = rd;
-            set_reg_val = use_regnames(rt) + " << " + dec_repr(sa);
+            set_reg_val = src(rt) + " << " + dec_repr(sa);
             break;
           case FUNCT_SRL:
             set_reg = rd;
-            set_reg_val = use_regnames(rt) + " >> " + dec_repr(sa);
+            set_reg_val = src(rt) + " >> " + dec_repr(sa);
             break;
           case FUNCT_SRA:
             set_reg = rd;
             set_reg_val =
-              "(int32_t)" + use_regnames(rt) + " >> " + dec_repr(sa);
+              "(int32_t)" + src(rt) + " >> " + dec_repr(sa);
             break;
           case FUNCT_SLLV:
             set_reg = rd;
             set_reg_val =
-              use_regnames(rt) + " << (" + use_regnames(rs) + "&31)";
+              src(rt) + " << (" + src(rs) + "&31)";
             break;
           case FUNCT_SRLV:
             set_reg = rd;
             set_reg_val =
-              use_regnames(rt) + " >> (" + use_regnames(rs) + "&31)";
+              src(rt) + " >> (" + src(rs) + "&31)";
             break;
           case FUNCT_SRAV:
             set_reg = rd;
             set_reg_val =
-              "(int32_t)" + use_regnames(rt) +
-              " >> (" + use_regnames(rs) + "&31)";
+              "(int32_t)" + src(rt) +
+              " >> (" + src(rs) + "&31)";
             break;
           case FUNCT_JR:
             jump_success = true;
@@ -226,39 +874,39 @@ void jit_main() {
             break;
           case FUNCT_ADDU:
             set_reg = rd;
-            set_reg_val = use_regnames(rs) + " + " + use_regnames(rt);
+            set_reg_val = src(rs) + " + " + src(rt);
             break;
           case FUNCT_SUBU:
             set_reg = rd;
-            set_reg_val = use_regnames(rs) + " - " + use_regnames(rt);
+            set_reg_val = src(rs) + " - " + src(rt);
             break;
           case FUNCT_AND:
             set_reg = rd;
-            set_reg_val = use_regnames(rs) + " & " + use_regnames(rt);
+            set_reg_val = src(rs) + " & " + src(rt);
             break;
           case FUNCT_OR:
             set_reg = rd;
-            set_reg_val = use_regnames(rs) + " | " + use_regnames(rt);
+            set_reg_val = src(rs) + " | " + src(rt);
             break;
           case FUNCT_XOR:
             set_reg = rd;
-            set_reg_val = use_regnames(rs) + " ^ " + use_regnames(rt);
+            set_reg_val = src(rs) + " ^ " + src(rt);
             break;
           case FUNCT_NOR:
             set_reg = rd;
             set_reg_val =
-              "~(" + use_regnames(rs) + " | " + use_regnames(rt) + ")";
+              "~(" + src(rs) + " | " + src(rt) + ")";
             break;
           case FUNCT_SLT:
             set_reg = rd;
             set_reg_val =
-              "((int32_t)" + use_regnames(rs) + " < (int32_t)" +
-              use_regnames(rt) + ")";
+              "((int32_t)" + src(rs) + " < (int32_t)" +
+              src(rt) + ")";
             break;
           case FUNCT_SLTU:
             set_reg = rd;
             set_reg_val =
-              "(" + use_regnames(rs) + " < " + use_regnames(rt) + ")";
+              "(" + src(rs) + " < " + src(rt) + ")";
             break;
           default:
             body << "  fprintf(stderr, \"error: SPECIAL: unknown funct: "
@@ -280,39 +928,39 @@ void jit_main() {
         set_reg_val = hex_repr((pc+1)*4);
         break;
       case OPCODE_BEQ:
-        branch_cond = use_regnames(rs) + " == " + use_regnames(rt);
+        branch_cond = src(rs) + " == " + src(rt);
         branch_target = pc+1+simm16;
         break;
       case OPCODE_BNE:
-        branch_cond = use_regnames(rs) + " != " + use_regnames(rt);
+        branch_cond = src(rs) + " != " + src(rt);
         branch_target = pc+1+simm16;
         break;
       case OPCODE_ADDIU:
         set_reg = rt;
-        set_reg_val = use_regnames(rs) + " + " + hex_repr(simm16);
+        set_reg_val = src(rs) + " + " + hex_repr(simm16);
         break;
       case OPCODE_SLTI:
         set_reg = rt;
         set_reg_val =
-          "((int32_t)" + use_regnames(rs) + " < (int32_t)" +
+          "((int32_t)" + src(rs) + " < (int32_t)" +
           hex_repr(simm16) + ")";
         break;
       case OPCODE_SLTIU:
         set_reg = rt;
         set_reg_val =
-          "(" + use_regnames(rs) + " < " + hex_repr(simm16) + ")";
+          "(" + src(rs) + " < " + hex_repr(simm16) + ")";
         break;
       case OPCODE_ANDI:
         set_reg = rt;
-        set_reg_val = use_regnames(rs) + " & " + hex_repr(uimm16);
+        set_reg_val = src(rs) + " & " + hex_repr(uimm16);
         break;
       case OPCODE_ORI:
         set_reg = rt;
-        set_reg_val = use_regnames(rs) + " | " + hex_repr(uimm16);
+        set_reg_val = src(rs) + " | " + hex_repr(uimm16);
         break;
       case OPCODE_XORI:
         set_reg = rt;
-        set_reg_val = use_regnames(rs) + " ^ " + hex_repr(uimm16);
+        set_reg_val = src(rs) + " ^ " + hex_repr(uimm16);
         break;
       case OPCODE_LUI:
         set_reg = rt;
@@ -338,104 +986,67 @@ void jit_main() {
             break;
           case COP1_FMT_MFC1:
             set_reg = rt;
-            set_reg_val = fregnames[fs];
+            set_reg_val = src(32+fs);
             break;
           case COP1_FMT_MTC1:
             set_freg = fs;
-            set_freg_val = use_regnames(rt);
+            set_freg_val = src(rt);
             break;
           case COP1_FMT_S:
             switch(funct) {
               case COP1_FUNCT_ADD:
                 set_freg = fd;
-                if(use_native_fp) {
-                  set_freg_val =
-                    "native_fadd(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_freg_val =
-                    "fadd(" + fregnames[fs] + ", " + fregnames[ft] + ")";
-                }
+                set_freg_val =
+                  fp_binary("fadd", "+", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_SUB:
                 set_freg = fd;
-                if(use_native_fp) {
-                  set_freg_val =
-                    "native_fsub(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_freg_val =
-                    "fsub(" + fregnames[fs] + ", " + fregnames[ft] + ")";
-                }
+                set_freg_val =
+                  fp_binary("fsub", "-", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_MUL:
                 set_freg = fd;
-                if(use_native_fp) {
-                  set_freg_val =
-                    "native_fmul(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_freg_val =
-                    "fmul(" + fregnames[fs] + ", " + fregnames[ft] + ")";
-                }
+                set_freg_val =
+                  fp_binary("fmul", "*", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_DIV:
                 set_freg = fd;
-                if(use_native_fp) {
-                  set_freg_val =
-                    "native_fdiv(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_freg_val =
-                    "fdiv(" + fregnames[fs] + ", " + fregnames[ft] + ")";
-                }
+                set_freg_val =
+                  fp_binary("fdiv", "/", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_SQRT:
                 set_freg = fd;
                 if(use_native_fp) {
-                  set_freg_val = "native_fsqrt(" + fregnames[fs] + ")";
+                  set_freg_val =
+                    "as_word(sqrtf(as_float(" + src(32+fs) + ")))";
                 } else {
-                  set_freg_val = "fsqrt(" + fregnames[fs] + ")";
+                  set_freg_val = "fsqrt(" + src(32+fs) + ")";
                 }
                 break;
               case COP1_FUNCT_MOV:
                 set_freg = fd;
-                set_freg_val = fregnames[fs];
+                set_freg_val = src(32+fs);
                 break;
               case COP1_FUNCT_CVT_W:
                 set_freg = fd;
                 if(use_native_fp) {
-                  set_freg_val = "native_ftoi(" + fregnames[fs] + ")";
+                  set_freg_val =
+                    "(uint32_t)(int32_t)as_float(" + src(32+fs) + ")";
                 } else {
-                  set_freg_val = "ftoi(" + fregnames[fs] + ")";
+                  set_freg_val = "ftoi(" + src(32+fs) + ")";
                 }
                 break;
               case COP1_FUNCT_C_EQ:
-                if(use_native_fp) {
-                  set_cc0_val = "native_feq(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_cc0_val = "feq(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                }
+                set_cc0_val =
+                  fp_compare("feq", "==", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_C_OLT:
-                if(use_native_fp) {
-                  set_cc0_val = "native_flt(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_cc0_val = "flt(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                }
+                set_cc0_val =
+                  fp_compare("flt", "<", src(32+fs), src(32+ft));
                 break;
               case COP1_FUNCT_C_OLE:
-                if(use_native_fp) {
-                  set_cc0_val = "native_fle(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                } else {
-                  set_cc0_val = "fle(" + fregnames[fs] + ", "
-                    + fregnames[ft] + ")";
-                }
+                set_cc0_val =
+                  fp_compare("fle", "<=", src(32+fs), src(32+ft));
                 break;
               default:
                 body << "  fprintf(stderr, \"error: COP1.S: unknown funct: "
@@ -451,9 +1062,10 @@ void jit_main() {
               case COP1_FUNCT_CVT_S:
                 set_freg = fd;
                 if(use_native_fp) {
-                  set_freg_val = "native_itof(" + fregnames[fs] + ")";
+                  set_freg_val =
+                    "as_word((float)(int32_t)" + src(32+fs) + ")";
                 } else {
-                  set_freg_val = "itof(" + fregnames[fs] + ")";
+                  set_freg_val = "itof(" + src(32+fs) + ")";
                 }
                 break;
               default:
@@ -475,25 +1087,32 @@ void jit_main() {
         }
         break;
       case OPCODE_LW:
-        set_reg = rt;
-        set_reg_val =
-          "load_word(" + use_regnames(rs) + " + " + hex_repr(simm16) + ")";
-        break;
       case OPCODE_LWC1:
-        set_freg = ft;
-        set_freg_val =
-          "load_word(" + use_regnames(rs) + " + " + hex_repr(simm16) + ")";
+        if(opcode == OPCODE_LW) {
+          set_reg = rt;
+          set_reg_val = load_repr(ram_pointer[rs], src(rs), simm16);
+        } else {
+          set_freg = ft;
+          set_freg_val = load_repr(ram_pointer[rs], src(rs), simm16);
+        }
+        if(show_statistics && !ram_pointer[rs]) {
+          body << "  current_pc = " << dec_repr(pc) << ";" << endl;
+        }
         break;
       case OPCODE_SW:
-        body <<
-          "  store_word(" + use_regnames(rs) + " + " + hex_repr(simm16) +
-          ", " + use_regnames(rt) + ");" << endl;
-        break;
-      case OPCODE_SWC1:
-        body <<
-          "  store_word(" + use_regnames(rs) + " + " + hex_repr(simm16) +
-          ", " + fregnames[ft] + ");" << endl;
+      case OPCODE_SWC1: {
+        string wrval =
+          opcode == OPCODE_SW ? src(rt) : src(32+ft);
+        if(show_commit_log) {
+          body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4)
+            << ": Memory[0x%08x] <- 0x%08x\\n\", "
+            << src(rs) << " + " << hex_repr(simm16) << ", "
+            << wrval << ");" << endl;
+        }
+        body << "  " << store_repr(ram_pointer[rs], src(rs), simm16, wrval)
+          << ";" << endl;
         break;
+      }
       default:
         body << "  fprintf(stderr, \"error: COP1: unknown opcode: "
           << dec_repr(opcode) << "\\n\");" << endl;
@@ -502,27 +1121,90 @@ void jit_main() {
           << hex_repr(pword) << "\\n\");" << endl;
         body << "  exit(1);" << endl;
     }
+    if(dead[pc]) {
+      set_reg = 0;
+      set_freg = -1;
+    } else if(results[pc].kind == reg_fact::CONSTANT) {
+      set_reg_val = set_freg_val = hex_repr(results[pc].value) + "U";
+    }
     if(set_reg) {
       body << "  " << regnames[set_reg] << " = " << set_reg_val << ";" << endl;
+      if(show_commit_log) {
+        body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4) << ": $"
+          << regnames[set_reg] << " <- 0x%08x\\n\", "
+          << regnames[set_reg] << ");" << endl;
+      }
     }
     if(set_freg != -1) {
       body << "  " << fregnames[set_freg] << " = "
         << set_freg_val << ";" << endl;
+      if(show_commit_log) {
+        body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4) << ": $"
+          << fregnames[set_freg] << " <- 0x%08x\\n\", "
+          << fregnames[set_freg] << ");" << endl;
+      }
     }
     if(set_cc0_val != "") {
       body << "  cc0 = "
         << set_cc0_val << ";" << endl;
     }
     if(branch_cond != "") {
+      branch_cond = expect_repr(profile, pc, branch_cond);
+    }
+    if(branch_cond != "" && !show_statistics && !show_commit_log) {
       body << "  if(" << branch_cond << ") goto L" <<
         hex_repr(branch_target*4) << ";" << endl;
+    } else if(branch_cond != "") {
+      body << "  if(" << branch_cond << ") {" << endl;
+      if(show_statistics) {
+        body << "    ++taken_counts[" << dec_repr(pc) << "];" << endl;
+      }
+      if(show_commit_log) {
+        body << "    fprintf(stderr, \"pc=" << hex_repr(pc*4)
+          << ": branch taken, " << hex_repr(branch_target*4)
+          << "\\n\");" << endl;
+      }
+      body << "    goto L" << hex_repr(branch_target*4) << ";" << endl;
+      body << "  }" << endl;
+      if(show_commit_log) {
+        body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4)
+          << ": branch not taken\\n\");" << endl;
+      }
     }
     if(jump_success) {
       if(jump_target_reg == -1) {
+        if(show_commit_log) {
+          body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4)
+            << ": branch taken, " << hex_repr(jump_target*4)
+            << "\\n\");" << endl;
+        }
         body << "  goto L" << hex_repr(jump_target*4) << ";" << endl;
       } else {
-        body << "  goto *labels[" << use_regnames(jump_target_reg) <<
-          ">>2];" << endl;
+        if(show_statistics) {
+          body << "  ++jump_counts[" << use_regnames(jump_target_reg)
+            << ">>2];" << endl;
+        }
+        if(show_commit_log) {
+          body << "  fprintf(stderr, \"pc=" << hex_repr(pc*4)
+            << ": branch taken, 0x%08x\\n\", "
+            << use_regnames(jump_target_reg) << ");" << endl;
+        }
+        vector<int> targets = profiled_targets(profile, pc, load_pc);
+        for(int target : targets) {
+          body << "  if(" << use_regnames(jump_target_reg) << " == "
+            << hex_repr(target*4) << ") goto L" << hex_repr(target*4)
+            << ";" << endl;
+        }
+        for(int ret_pc : return_sites[pc]) {
+          if(find(targets.begin(), targets.end(), ret_pc) != targets.end()) {
+            continue;
+          }
+          body << "  if(ra == " << hex_repr(ret_pc*4) << ") goto L"
+            << hex_repr(ret_pc*4) << ";" << endl;
+        }
+        body << "  npc = " << use_regnames(jump_target_reg) << ">>2;"
+          << endl;
+        body << "  goto *labels[npc];" << endl;
       }
     }
   }
@@ -533,21 +1215,23 @@ void jit_main() {
   }
 
   ostringstream command;
-  // command << "gcc -std=c99 -O2 -Wall -Wextra -g ";
-  command << "gcc -std=c99 -Wall -Wextra -g ";
+  // The FPU is built from source together with the program under LTO, so
+  // that gcc can inline the bit-exact soft-FPU routines into the
+  // generated code instead of calling into prebuilt objects.
+  command << "gcc -std=c99 -O2 -flto -Wall -Wextra -g ";
   command << "-o " << "tmp-qksim-compiled" << " ";
   command << "tmp-qksim-compiled.c ";
-  command << "fpu/C/fadd.o ";
-  command << "fpu/C/fcmp.o ";
-  command << "fpu/C/fdiv.o ";
-  command << "fpu/C/ffloor.o ";
-  command << "fpu/C/finv.o ";
-  command << "fpu/C/float.o ";
-  command << "fpu/C/fmul.o ";
-  command << "fpu/C/fsqrt.o ";
-  command << "fpu/C/ftoi.o ";
-  command << "fpu/C/itof.o ";
-  command << "native_fpu.o ";
+  command << "fpu/C/fadd.c ";
+  command << "fpu/C/fcmp.c ";
+  command << "fpu/C/fdiv.c ";
+  command << "fpu/C/ffloor.c ";
+  command << "fpu/C/finv.c ";
+  command << "fpu/C/float.c ";
+  command << "fpu/C/fmul.c ";
+  command << "fpu/C/fsqrt.c ";
+  command << "fpu/C/ftoi.c ";
+  command << "fpu/C/itof.c ";
+  command << "native_fpu.c ";
   command << "-lm ";
   cerr << command.str() << endl;
   int retval = system(command.str().c_str());
@@ -558,8 +1242,27 @@ void jit_main() {
     fprintf(stderr, "error: compiler failed\n");
     exit(1);
   }
-  int inputfd = open("tmp-qksim-input.dat", O_RDONLY);
-  dup2(inputfd, 0);
-  printf("hoge\n");
+  if(show_statistics) {
+    // Stay around to turn the dumped counters into statistics.
+    remove(statistics_file);
+    pid_t pid = fork();
+    if(pid < 0) {
+      fprintf(stderr, "error: fork failed\n");
+      exit(1);
+    } else if(pid == 0) {
+      execlp("./tmp-qksim-compiled", "./tmp-qksim-compiled", NULL);
+      fprintf(stderr, "error: cannot execute compiled program\n");
+      _exit(1);
+    }
+    int status;
+    if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+      fprintf(stderr, "error: compiled program terminated abnormally\n");
+      exit(1);
+    }
+    if(WEXITSTATUS(status) == 0) {
+      show_jit_statistics(ram, load_pc, leader);
+    }
+    exit(WEXITSTATUS(status));
+  }
   execlp("./tmp-qksim-compiled", "./tmp-qksim-compiled", NULL);
 }
@@ -0,0 +1,338 @@
+#ifndef JIT_SLOWPATH_H_
+#define JIT_SLOWPATH_H_
+/* Slow path of JIT-compiled programs.
+ *
+ * Only block leaders found by control-flow recovery get a label in the
+ * generated code. When JR lands anywhere else, the generated code spills
+ * its registers and calls run_slow_path(), which interprets instructions
+ * until control reaches a leader again and returns its address.
+ *
+ * Included by the generated program after ram, load_word() and
+ * store_word() (and, with QKSIM_STATISTICS, the counters) are defined.
+ * QKSIM_NATIVE_FP, QKSIM_STATISTICS and QKSIM_COMMIT_LOG select the same
+ * behavior as the corresponding command-line options. */
+
+#ifdef QKSIM_NATIVE_FP
+#define SLOWPATH_FPU(name) native_##name
+#else
+#define SLOWPATH_FPU(name) name
+#endif
+
+#ifdef QKSIM_COMMIT_LOG
+static const char slowpath_regnames[32][5] = {
+  "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+  "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+  "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+  "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+#endif
+
+static void slowpath_decode_error(const char *what, int code,
+                                  uint32_t pc, uint32_t pword) {
+  fprintf(stderr, "error: %s: %d\n", what, code);
+  fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n", pc*4, pword);
+  exit(1);
+}
+
+static uint32_t run_slow_path(uint32_t reg[32], uint32_t freg[32], int *cc0,
+                              uint32_t pc, const void *const labels[],
+                              const void *slow_label, uint32_t num_words) {
+#ifdef QKSIM_STATISTICS
+  /* Instructions are counted here after they complete, so a halt in the
+   * slow path must not be attributed to native code. */
+  current_pc = -1;
+#endif
+  do {
+    if(pc >= num_words) {
+      fprintf(stderr, "error: program counter 0x%08x is out of range\n",
+          pc*4);
+      exit(1);
+    }
+    uint32_t pword = ram[pc];
+    int opcode = pword>>26;
+    int rs = (pword>>21)&31;
+    int rt = (pword>>16)&31;
+    int rd = (pword>>11)&31;
+    int sa = (pword>> 6)&31;
+    int funct = pword&63;
+    int fmt = rs;
+    int ft = rt;
+    int fs = rd;
+    int fd = sa;
+    uint32_t uimm16 = (uint16_t)pword;
+    uint32_t simm16 = (int16_t)pword;
+    uint32_t jt = (pc>>26<<26)|(pword&((1U<<26)-1));
+    int is_branch = 0;
+    int branch_success = 0;
+    uint32_t branch_target = 0;
+    int set_reg = 0;
+    uint32_t set_reg_val = 0;
+    int set_freg = -1;
+    uint32_t set_freg_val = 0;
+    switch(opcode) {
+      case OPCODE_SPECIAL:
+        switch(funct) {
+          case FUNCT_SLL:
+            set_reg = rd;
+            set_reg_val = reg[rt] << sa;
+            break;
+          case FUNCT_SRL:
+            set_reg = rd;
+            set_reg_val = reg[rt] >> sa;
+            break;
+          case FUNCT_SRA:
+            set_reg = rd;
+            set_reg_val = (int32_t)reg[rt] >> sa;
+            break;
+          case FUNCT_SLLV:
+            set_reg = rd;
+            set_reg_val = reg[rt] << (reg[rs]&31);
+            break;
+          case FUNCT_SRLV:
+            set_reg = rd;
+            set_reg_val = reg[rt] >> (reg[rs]&31);
+            break;
+          case FUNCT_SRAV:
+            set_reg = rd;
+            set_reg_val = (int32_t)reg[rt] >> (reg[rs]&31);
+            break;
+          case FUNCT_JR:
+            is_branch = 1;
+            branch_success = 1;
+            branch_target = reg[rs]>>2;
+            break;
+          case FUNCT_JALR:
+            if(rs == rd) {
+              fprintf(stderr, "error: JALR: rs and rd must be different\n");
+              fprintf(stderr, "pc = 0x%08x, pword = 0x%08x\n",
+                  pc*4, pword);
+              exit(1);
+            }
+            is_branch = 1;
+            branch_success = 1;
+            branch_target = reg[rs]>>2;
+            set_reg = REG_RA;
+            set_reg_val = (pc + 1) * 4;
+            break;
+          case FUNCT_ADDU:
+            set_reg = rd;
+            set_reg_val = reg[rs] + reg[rt];
+            break;
+          case FUNCT_SUBU:
+            set_reg = rd;
+            set_reg_val = reg[rs] - reg[rt];
+            break;
+          case FUNCT_AND:
+            set_reg = rd;
+            set_reg_val = reg[rs] & reg[rt];
+            break;
+          case FUNCT_OR:
+            set_reg = rd;
+            set_reg_val = reg[rs] | reg[rt];
+            break;
+          case FUNCT_XOR:
+            set_reg = rd;
+            set_reg_val = reg[rs] ^ reg[rt];
+            break;
+          case FUNCT_NOR:
+            set_reg = rd;
+            set_reg_val = ~(reg[rs] | reg[rt]);
+            break;
+          case FUNCT_SLT:
+            set_reg = rd;
+            set_reg_val = ((int32_t)reg[rs] < (int32_t)reg[rt]);
+            break;
+          case FUNCT_SLTU:
+            set_reg = rd;
+            set_reg_val = (reg[rs] < reg[rt]);
+            break;
+          default:
+            slowpath_decode_error("SPECIAL: unknown funct", funct, pc, pword);
+        }
+        break;
+      case OPCODE_J:
+      case OPCODE_JAL:
+        is_branch = 1;
+        branch_success = 1;
+        branch_target = jt;
+        if(opcode == OPCODE_JAL) {
+          set_reg = REG_RA;
+          set_reg_val = (pc + 1) * 4;
+        }
+        break;
+      case OPCODE_BEQ:
+        is_branch = 1;
+        branch_success = (reg[rs] == reg[rt]);
+        branch_target = pc+1+simm16;
+        break;
+      case OPCODE_BNE:
+        is_branch = 1;
+        branch_success = (reg[rs] != reg[rt]);
+        branch_target = pc+1+simm16;
+        break;
+      case OPCODE_ADDIU:
+        set_reg = rt;
+        set_reg_val = reg[rs] + simm16;
+        break;
+      case OPCODE_SLTI:
+        set_reg = rt;
+        set_reg_val = ((int32_t)reg[rs] < (int32_t)simm16);
+        break;
+      case OPCODE_SLTIU:
+        set_reg = rt;
+        set_reg_val = (reg[rs] < simm16);
+        break;
+      case OPCODE_ANDI:
+        set_reg = rt;
+        set_reg_val = reg[rs] & uimm16;
+        break;
+      case OPCODE_ORI:
+        set_reg = rt;
+        set_reg_val = reg[rs] | uimm16;
+        break;
+      case OPCODE_XORI:
+        set_reg = rt;
+        set_reg_val = reg[rs] ^ uimm16;
+        break;
+      case OPCODE_LUI:
+        set_reg = rt;
+        set_reg_val = uimm16 << 16;
+        break;
+      case OPCODE_COP1:
+        switch(fmt) {
+          case COP1_FMT_BRANCH:
+            if(ft != 0 && ft != 1) {
+              slowpath_decode_error("BC1x: unknown condition", ft, pc, pword);
+            }
+            is_branch = 1;
+            branch_success = ft ? *cc0 : !*cc0;
+            branch_target = pc+1+simm16;
+            break;
+          case COP1_FMT_MFC1:
+            set_reg = rt;
+            set_reg_val = freg[fs];
+            break;
+          case COP1_FMT_MTC1:
+            set_freg = fs;
+            set_freg_val = reg[rt];
+            break;
+          case COP1_FMT_S:
+            switch(funct) {
+              case COP1_FUNCT_ADD:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(fadd)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_SUB:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(fsub)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_MUL:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(fmul)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_DIV:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(fdiv)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_SQRT:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(fsqrt)(freg[fs]);
+                break;
+              case COP1_FUNCT_MOV:
+                set_freg = fd;
+                set_freg_val = freg[fs];
+                break;
+              case COP1_FUNCT_CVT_W:
+                set_freg = fd;
+                set_freg_val = SLOWPATH_FPU(ftoi)(freg[fs]);
+                break;
+              case COP1_FUNCT_C_EQ:
+                *cc0 = SLOWPATH_FPU(feq)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_C_OLT:
+                *cc0 = SLOWPATH_FPU(flt)(freg[fs], freg[ft]);
+                break;
+              case COP1_FUNCT_C_OLE:
+                *cc0 = SLOWPATH_FPU(fle)(freg[fs], freg[ft]);
+                break;
+              default:
+                slowpath_decode_error("COP1.S: unknown funct", funct,
+                                      pc, pword);
+            }
+            break;
+          case COP1_FMT_W:
+            if(funct != COP1_FUNCT_CVT_S) {
+              slowpath_decode_error("COP1.W: unknown funct", funct,
+                                    pc, pword);
+            }
+            set_freg = fd;
+            set_freg_val = SLOWPATH_FPU(itof)(freg[fs]);
+            break;
+          default:
+            slowpath_decode_error("COP1: unknown fmt", fmt, pc, pword);
+        }
+        break;
+      case OPCODE_LW:
+      case OPCODE_LWC1:
+        set_reg_val = load_word(reg[rs] + simm16);
+        if(opcode == OPCODE_LW) {
+          set_reg = rt;
+        } else {
+          set_freg = ft;
+          set_freg_val = set_reg_val;
+        }
+        break;
+      case OPCODE_SW:
+      case OPCODE_SWC1: {
+        uint32_t addr = reg[rs] + simm16;
+        uint32_t wrval = opcode == OPCODE_SW ? reg[rt] : freg[ft];
+#ifdef QKSIM_COMMIT_LOG
+        fprintf(stderr, "pc=0x%08x: Memory[0x%08x] <- 0x%08x\n",
+            pc*4, addr, wrval);
+#endif
+        store_word(addr, wrval);
+        break;
+      }
+      default:
+        slowpath_decode_error("unknown opcode", opcode, pc, pword);
+    }
+    if(set_reg) {
+      reg[set_reg] = set_reg_val;
+#ifdef QKSIM_COMMIT_LOG
+      fprintf(stderr, "pc=0x%08x: $%s <- 0x%08x\n",
+          pc*4, slowpath_regnames[set_reg], set_reg_val);
+#endif
+    }
+    if(set_freg != -1) {
+      freg[set_freg] = set_freg_val;
+#ifdef QKSIM_COMMIT_LOG
+      fprintf(stderr, "pc=0x%08x: $f%d <- 0x%08x\n",
+          pc*4, set_freg, set_freg_val);
+#endif
+    }
+#ifdef QKSIM_COMMIT_LOG
+    if(is_branch) {
+      if(branch_success) {
+        fprintf(stderr, "pc=0x%08x: branch taken, 0x%08x\n",
+            pc*4, branch_target*4);
+      } else {
+        fprintf(stderr, "pc=0x%08x: branch not taken\n", pc*4);
+      }
+    }
+#else
+    (void)is_branch;
+#endif
+#ifdef QKSIM_STATISTICS
+    ++slow_counts[pc];
+    if(branch_success && branch_target < num_words) {
+      ++jump_counts[branch_target];
+    }
+#endif
+    pc = branch_success ? branch_target : pc+1;
+  } while(pc >= num_words || labels[pc] == slow_label);
+  return pc;
+}
+
+#undef SLOWPATH_FPU
+
+#endif /* JIT_SLOWPATH_H_ */
@@ -1,12 +1,14 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <boost/program_options.hpp>
 #include "options.h"
 #include "ils.h"
 #include "jit.h"
 #include "cas.h"
+#include "sweep.h"
 using namespace std;
 using namespace boost::program_options;
 
@@ -15,10 +17,39 @@ int main(int argc, char *argv[]) {
 
   options1.add_options()
       ("sim,s", value<string>()->default_value("ils"),
-                "which implementation to use (ils,jit,cas)")
+                "which implementation to use (ils,jit,cas,sweep)")
       ("native-fp,n", "use native floating-point unit")
       ("show-commit-log,c", "show commit log")
       ("show-statistics,t", "show statistics")
+      ("skip-idle", "skip repeated polling of RS-232C ports (cas)")
+      ("profile-out", value<string>(),
+                "write branch profile to file (ils)")
+      ("profile-in", value<string>(),
+                "optimize for branch profile from file (jit)")
+      ("cas-config", value<string>(),
+                "read microarchitecture parameters from file (cas)")
+      ("cas-param", value<vector<string>>(),
+                "set a microarchitecture parameter, e.g. rob_size=64 (cas)")
+      ("sweep", value<string>(),
+                "file of workloads and parameter values to sweep (sweep)")
+      ("sweep-dir", value<string>(),
+                "job queue directory, may be shared by machines (sweep)")
+      ("sweep-out", value<string>(),
+                "write the result table to file instead of stdout (sweep)")
+      ("jobs,j", value<int>(),
+                "number of simulations to run at once (sweep)")
+      ("pc-stats", value<string>(),
+                "write stalls and mispredictions per pc to file (cas)")
+      ("interval-out", value<string>(),
+                "write statistics per interval to a CSV file (ils,cas)")
+      ("interval", value<uint64_t>(),
+                "interval length in instructions (ils) or cycles (cas)")
+      ("trace", value<string>(),
+                "write a pipeline trace for the Konata viewer to file (cas)")
+      ("trace-from", value<uint64_t>(),
+                "trace the instructions fetched from this cycle on (cas)")
+      ("trace-to", value<uint64_t>(),
+                "trace the instructions fetched before this cycle (cas)")
       ("help,h", "show help")
   ;
   variables_map values;
@@ -29,6 +60,45 @@ int main(int argc, char *argv[]) {
     if(values.count("native-fp")) use_native_fp = true;
     if(values.count("show-commit-log")) show_commit_log = true;
     if(values.count("show-statistics")) show_statistics = true;
+    if(values.count("skip-idle")) skip_idle = true;
+    if(values.count("profile-out")) {
+      profile_output_file = values["profile-out"].as<string>();
+    }
+    if(values.count("profile-in")) {
+      profile_input_file = values["profile-in"].as<string>();
+    }
+    if(values.count("cas-config")) {
+      cas_config_file = values["cas-config"].as<string>();
+    }
+    if(values.count("cas-param")) {
+      cas_config_params = values["cas-param"].as<vector<string>>();
+    }
+    if(values.count("sweep")) sweep_file = values["sweep"].as<string>();
+    if(values.count("sweep-dir")) {
+      sweep_dir = values["sweep-dir"].as<string>();
+    }
+    if(values.count("sweep-out")) {
+      sweep_output_file = values["sweep-out"].as<string>();
+    }
+    if(values.count("jobs")) sweep_workers = values["jobs"].as<int>();
+    if(values.count("pc-stats")) {
+      pc_stats_file = values["pc-stats"].as<string>();
+    }
+    if(values.count("interval-out")) {
+      interval_file = values["interval-out"].as<string>();
+    }
+    if(values.count("interval")) {
+      interval_length = values["interval"].as<uint64_t>();
+      if(interval_length == 0) {
+        cerr << "error: interval must be positive" << endl;
+        exit(1);
+      }
+    }
+    if(values.count("trace")) trace_file = values["trace"].as<string>();
+    if(values.count("trace-from")) {
+      trace_from = values["trace-from"].as<uint64_t>();
+    }
+    if(values.count("trace-to")) trace_to = values["trace-to"].as<uint64_t>();
     if(values.count("help")) {
       cerr << options1 << endl;
     } else if(sim_impl == "ils") {
@@ -37,6 +107,8 @@ int main(int argc, char *argv[]) {
       jit_main();
     } else if(sim_impl == "cas") {
       cas_main();
+    } else if(sim_impl == "sweep") {
+      sweep_main();
     } else {
       cerr << "Unknown implementation name : " << sim_impl << endl;
       exit(1);
@@ -3,3 +3,18 @@
 bool use_native_fp = false;
 bool show_commit_log = false;
 bool show_statistics = false;
+bool skip_idle = false;
+std::string profile_output_file;
+std::string profile_input_file;
+std::string cas_config_file;
+std::vector<std::string> cas_config_params;
+std::string sweep_file;
+std::string sweep_dir = "tmp-qksim-sweep";
+std::string sweep_output_file;
+int sweep_workers = 0;
+std::string pc_stats_file;
+std::string interval_file;
+uint64_t interval_length = 1000000;
+std::string trace_file;
+uint64_t trace_from = 0;
+uint64_t trace_to = UINT64_MAX;
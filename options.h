@@ -1,8 +1,27 @@
 #ifndef OPTIONS_H_
 #define OPTIONS_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 extern bool use_native_fp;
 extern bool show_commit_log;
 extern bool show_statistics;
+extern bool skip_idle;
+extern std::string profile_output_file;
+extern std::string profile_input_file;
+extern std::string cas_config_file;
+extern std::vector<std::string> cas_config_params;
+extern std::string sweep_file;
+extern std::string sweep_dir;
+extern std::string sweep_output_file;
+extern int sweep_workers;
+extern std::string pc_stats_file;
+extern std::string interval_file;
+extern uint64_t interval_length;
+extern std::string trace_file;
+extern uint64_t trace_from;
+extern uint64_t trace_to;
 
 #endif /* OPTIONS_H_ */
@@ -0,0 +1,101 @@
+#include <cstdint>
+#include <cinttypes>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "pipeline_trace.h"
+using namespace std;
+
+static const char *const stage_names[] = { "Ds", "Is", "Mem", "Wb" };
+
+pipeline_trace::pipeline_trace(uint64_t from, uint64_t to)
+  : from(from), to(to), current_cycle(0), in_flight(0) {}
+
+int pipeline_trace::fetch(int pc, uint32_t pword) {
+  if(current_cycle < from || current_cycle >= to) return -1;
+  record_type r;
+  r.fetch_cycle = current_cycle;
+  r.pc = pc;
+  r.pword = pword;
+  fill(r.stage_cycles, r.stage_cycles+num_stages, 0);
+  r.retire_cycle = 0;
+  r.flushed = false;
+  records.push_back(r);
+  ++in_flight;
+  return records.size()-1;
+}
+
+void pipeline_trace::record(int id, stage s) {
+  record_type &r = records[id];
+  if(r.stage_cycles[s] == 0) {
+    r.stage_cycles[s] = current_cycle - r.fetch_cycle;
+  }
+}
+
+void pipeline_trace::retire(int id, bool flushed) {
+  if(id < 0) return;
+  record_type &r = records[id];
+  r.retire_cycle = current_cycle - r.fetch_cycle;
+  r.flushed = flushed;
+  --in_flight;
+}
+
+void pipeline_trace::write(const string &filename) const {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", filename.c_str());
+    return;
+  }
+  // The events of all records by cycle; kind -1 is the fetch and
+  // num_stages the retirement.
+  struct event {
+    uint64_t cycle;
+    int id;
+    int kind;
+  };
+  vector<event> events;
+  for(int id = 0; id < (int)records.size(); ++id) {
+    const record_type &r = records[id];
+    events.push_back(event{r.fetch_cycle, id, -1});
+    for(int s = 0; s < num_stages; ++s) {
+      if(r.stage_cycles[s]) {
+        events.push_back(event{r.fetch_cycle + r.stage_cycles[s], id, s});
+      }
+    }
+    if(r.retire_cycle) {
+      events.push_back(event{r.fetch_cycle + r.retire_cycle, id,
+                             num_stages});
+    }
+  }
+  stable_sort(events.begin(), events.end(),
+      [](const event &a, const event &b) { return a.cycle < b.cycle; });
+  fprintf(fp, "Kanata\t0004\n");
+  uint64_t cycle = events.empty() ? 0 : events[0].cycle;
+  fprintf(fp, "C=\t%" PRIu64 "\n", cycle);
+  vector<const char *> current_stage(records.size(), "F");
+  int num_retired = 0;
+  for(const event &e : events) {
+    if(e.cycle != cycle) {
+      fprintf(fp, "C\t%" PRIu64 "\n", e.cycle - cycle);
+      cycle = e.cycle;
+    }
+    if(e.kind < 0) {
+      const record_type &r = records[e.id];
+      fprintf(fp, "I\t%d\t%d\t0\n", e.id, e.id);
+      fprintf(fp, "L\t%d\t0\t%08x: %08x\n", e.id, (uint32_t)r.pc*4, r.pword);
+      fprintf(fp, "S\t%d\t0\tF\n", e.id);
+      continue;
+    }
+    fprintf(fp, "E\t%d\t0\t%s\n", e.id, current_stage[e.id]);
+    if(e.kind < num_stages) {
+      current_stage[e.id] = stage_names[e.kind];
+      fprintf(fp, "S\t%d\t0\t%s\n", e.id, current_stage[e.id]);
+    } else if(records[e.id].flushed) {
+      fprintf(fp, "R\t%d\t%d\t1\n", e.id, e.id);
+    } else {
+      fprintf(fp, "R\t%d\t%d\t0\n", e.id, num_retired++);
+    }
+  }
+  fclose(fp);
+}
@@ -0,0 +1,50 @@
+#ifndef PIPELINE_TRACE_H_
+#define PIPELINE_TRACE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pipeline events of the instructions fetched in a window of cycles. Each
+// instruction has a fixed-size record, which write() converts to the
+// Kanata format of the Konata pipeline viewer.
+class pipeline_trace {
+ public:
+  // The stages after fetch, in pipeline order. MEMORY is the memory
+  // access of a load or store, and WRITEBACK the broadcast on the CDB.
+  enum stage { DISPATCH, ISSUE, MEMORY, WRITEBACK, num_stages };
+
+  // Traces the instructions fetched in cycles [from, to).
+  pipeline_trace(uint64_t from, uint64_t to);
+  // The cycle the following events happen in.
+  void set_cycle(uint64_t cycle) { current_cycle = cycle; }
+  // Returns the id of a new record, or -1 outside the window. pc is a word
+  // address.
+  int fetch(int pc, uint32_t pword);
+  // Only the first time an instruction reaches a stage is recorded.
+  void record(int id, stage s);
+  // Commits the instruction, or squashes it if flushed is set. An id of -1
+  // is ignored.
+  void retire(int id, bool flushed);
+  // The records not yet retired.
+  int num_in_flight() const { return in_flight; }
+  void write(const std::string &filename) const;
+
+ private:
+  // Cycles are kept relative to the fetch; 0 means not reached.
+  struct record_type {
+    uint64_t fetch_cycle;
+    int pc;
+    uint32_t pword;
+    uint32_t stage_cycles[num_stages];
+    uint32_t retire_cycle;
+    bool flushed;
+  };
+  uint64_t from;
+  uint64_t to;
+  uint64_t current_cycle;
+  int in_flight;
+  std::vector<record_type> records;
+};
+
+#endif /* PIPELINE_TRACE_H_ */
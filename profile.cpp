@@ -0,0 +1,59 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <string>
+#include "profile.h"
+using namespace std;
+
+// The profile is a text file with one record per line:
+//   b <pc> <taken> <not taken>    for a conditional branch
+//   j <pc> <target> <count>       for each target of JR/JALR
+// Addresses are byte addresses in hex, as in the commit log.
+
+void write_branch_profile(const string &filename,
+                          const branch_profile &profile) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", filename.c_str());
+    exit(1);
+  }
+  for(const auto &branch : profile.branches) {
+    fprintf(fp, "b 0x%08x %lld %lld\n", branch.first*4,
+        (long long int)branch.second.first,
+        (long long int)branch.second.second);
+  }
+  for(const auto &jump : profile.jumps) {
+    for(const auto &target : jump.second) {
+      fprintf(fp, "j 0x%08x 0x%08x %lld\n", jump.first*4, target.first*4,
+          (long long int)target.second);
+    }
+  }
+  fclose(fp);
+}
+
+void read_branch_profile(const string &filename, branch_profile &profile) {
+  FILE *fp = fopen(filename.c_str(), "r");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", filename.c_str());
+    exit(1);
+  }
+  profile.branches.clear();
+  profile.jumps.clear();
+  char kind;
+  while(fscanf(fp, " %c", &kind) == 1) {
+    unsigned int pc, target;
+    long long int taken, not_taken, count;
+    if(kind == 'b' &&
+       fscanf(fp, "%x %lld %lld", &pc, &taken, &not_taken) == 3) {
+      profile.branches[pc>>2] = make_pair(taken, not_taken);
+    } else if(kind == 'j' &&
+              fscanf(fp, "%x %x %lld", &pc, &target, &count) == 3) {
+      profile.jumps[pc>>2][target>>2] = count;
+    } else {
+      fprintf(stderr, "error: %s: malformed profile\n", filename.c_str());
+      exit(1);
+    }
+  }
+  fclose(fp);
+}
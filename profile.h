@@ -0,0 +1,23 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+// Branch profile collected by ILS (--profile-out) and consumed by the JIT
+// (--profile-in). Keys are word addresses.
+struct branch_profile {
+  // Conditional branch pc -> (taken count, not-taken count)
+  std::map<int, std::pair<int64_t, int64_t>> branches;
+  // JR/JALR pc -> target -> count
+  std::map<int, std::map<int, int64_t>> jumps;
+};
+
+void write_branch_profile(const std::string &filename,
+                          const branch_profile &profile);
+void read_branch_profile(const std::string &filename,
+                         branch_profile &profile);
+
+#endif /* PROFILE_H_ */
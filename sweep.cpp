@@ -0,0 +1,353 @@
+#include <cstdint>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "options.h"
+#include "cas.h"
+#include "cas_config.h"
+#include "sweep.h"
+using namespace std;
+
+// The sweep file lists workloads and the values to try for parameters:
+//   workload = examples/fib-loop.bin
+//   rob_size = 16 32 64
+//   alu_entries = 2 4
+// Every combination of the values is simulated on every workload; other
+// parameters come from --cas-config and --cas-param.
+//
+// Jobs are handed out through the queue directory (--sweep-dir). A job is
+// claimed by creating <key>.claim exclusively and leaves its record in
+// <key>.csv and the simulator's stderr in <key>.log, where the key hashes
+// the workload file, the full configuration and the record columns; a
+// directory left by another sweep thus only shares the jobs it really
+// ran, and a changed workload or grid is simulated again. Idle workers claim
+// the next free job, and runs on several machines sharing the directory
+// split the jobs between them. The run that finds every record present
+// writes the table; rerunning after the last shard finishes collects it.
+// Remove the .claim file of a job whose machine died to run it again.
+
+struct sweep_workload {
+  string file;
+  vector<uint32_t> program;
+  long input_offset;
+  // FNV-1a of the whole file, program and input.
+  uint64_t hash;
+};
+
+struct sweep_param {
+  string name;
+  vector<string> values;
+};
+
+static vector<sweep_workload> workloads;
+static vector<sweep_param> params;
+static int num_points;
+static vector<string> job_keys;
+
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t size) {
+  for(size_t i = 0; i < size; ++i) {
+    hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static string trim(const string &s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if(begin == string::npos) return "";
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(begin, end-begin+1);
+}
+
+static void read_sweep_file(const string &filename) {
+  FILE *fp = fopen(filename.c_str(), "r");
+  if(!fp) {
+    fprintf(stderr, "error: cannot open %s\n", filename.c_str());
+    exit(1);
+  }
+  char buf[1024];
+  for(int lineno = 1; fgets(buf, sizeof(buf), fp); ++lineno) {
+    string line = buf;
+    line = trim(line.substr(0, line.find('#')));
+    if(line.empty()) continue;
+    size_t eq = line.find('=');
+    string name = trim(line.substr(0, eq));
+    string values = eq == string::npos ? "" : line.substr(eq+1);
+    sweep_param param;
+    param.name = name;
+    for(size_t pos = 0; ; ) {
+      pos = values.find_first_not_of(" \t", pos);
+      if(pos == string::npos) break;
+      size_t end = values.find_first_of(" \t", pos);
+      param.values.push_back(values.substr(pos, end-pos));
+      pos = end;
+    }
+    if(param.values.empty() ||
+       (name == "workload" && param.values.size() > 1)) {
+      fprintf(stderr, "error: %s:%d: malformed line: %s\n",
+          filename.c_str(), lineno, line.c_str());
+      exit(1);
+    }
+    if(name == "workload") {
+      sweep_workload workload;
+      workload.file = param.values[0];
+      workloads.push_back(workload);
+    } else {
+      params.push_back(param);
+    }
+  }
+  fclose(fp);
+  if(workloads.empty()) {
+    fprintf(stderr, "error: %s: no workload\n", filename.c_str());
+    exit(1);
+  }
+}
+
+// The programs are loaded once here; jobs get them through fork().
+static void load_workloads() {
+  for(sweep_workload &workload : workloads) {
+    FILE *fp = fopen(workload.file.c_str(), "rb");
+    if(!fp) {
+      fprintf(stderr, "error: cannot open %s\n", workload.file.c_str());
+      exit(1);
+    }
+    cas_read_program(fp, workload.program);
+    workload.input_offset = ftell(fp);
+    rewind(fp);
+    workload.hash = 14695981039346656037ULL;
+    char buf[4096];
+    for(size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0; ) {
+      workload.hash = fnv1a(workload.hash, buf, n);
+    }
+    fclose(fp);
+  }
+}
+
+static cas_config point_config(const cas_config &base, int point) {
+  cas_config config = base;
+  for(const sweep_param &param : params) {
+    int n = param.values.size();
+    set_cas_config_param(param.name + "=" + param.values[point%n], config);
+    point /= n;
+  }
+  return config;
+}
+
+// "name=value name=value ..." for messages, or "value,value,..." for CSV.
+static string point_values(int point, bool with_names) {
+  string ret;
+  for(const sweep_param &param : params) {
+    int n = param.values.size();
+    if(with_names) {
+      if(!ret.empty()) ret += " ";
+      ret += param.name + "=";
+    } else {
+      ret += ",";
+    }
+    ret += param.values[point%n];
+    point /= n;
+  }
+  return ret;
+}
+
+// A rough area cost, in units of one ROB entry: buffer entries cost about
+// the same each, a functional unit port costs more the fewer cycles it has,
+// each instruction of pipeline width beyond the first costs 8 entries, and
+// 64 bytes of cache cost about one entry.
+static double area_cost(const cas_config &c) {
+  return c.rob_size +
+    c.lsbuffer_address_entries + c.lsbuffer_memory_entries +
+    c.brancher_entries + c.alu_entries + c.fp_adder_entries +
+    c.fp_multiplier_entries + c.fp_comparator_entries +
+    c.fp_others_entries +
+    c.ras_depth * 0.25 +
+    4.0 * c.brancher_ports / c.brancher_latency +
+    8.0 * c.alu_ports / c.alu_latency +
+    32.0 * c.fp_adder_ports / c.fp_adder_latency +
+    32.0 * c.fp_multiplier_ports / c.fp_multiplier_latency +
+    8.0 * c.fp_comparator_ports / c.fp_comparator_latency +
+    64.0 * c.fp_others_ports / c.fp_others_latency +
+    8.0 * (c.fetch_width + c.dispatch_width + c.commit_width - 3) +
+    (c.icache_size + c.dcache_size) / 64.0;
+}
+
+static void make_job_keys(const cas_config &base, int num_jobs) {
+  for(int job = 0; job < num_jobs; ++job) {
+    string key = cas_config_string(point_config(base, job % num_points)) +
+      cas_result_columns;
+    uint64_t hash = fnv1a(workloads[job / num_points].hash,
+                          key.data(), key.size());
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016" PRIx64, hash);
+    job_keys.push_back(buf);
+  }
+}
+
+static string job_file(int job, const char *suffix) {
+  return sweep_dir + "/" + job_keys[job] + suffix;
+}
+
+static bool claim_job(int job) {
+  int fd = open(job_file(job, ".claim").c_str(),
+                O_CREAT|O_EXCL|O_WRONLY, 0644);
+  if(fd < 0) return false;
+  close(fd);
+  return true;
+}
+
+static void run_job(const cas_config &base, int job) {
+  const sweep_workload &workload = workloads[job / num_points];
+  int point = job % num_points;
+  cas_config config = point_config(base, point);
+  string result_file = job_file(job, ".csv");
+  pid_t pid = fork();
+  if(pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if(pid == 0) {
+    if(!freopen(job_file(job, ".log").c_str(), "w", stderr) ||
+       !freopen("/dev/null", "w", stdout) ||
+       !freopen(workload.file.c_str(), "rb", stdin) ||
+       fseek(stdin, workload.input_offset, SEEK_SET) != 0) {
+      _exit(1);
+    }
+    cas_run_program(workload.program, config, result_file);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+    access(result_file.c_str(), F_OK) == 0;
+  if(!ok) {
+    FILE *fp = fopen(result_file.c_str(), "w");
+    if(fp) {
+      fprintf(fp, "error\n");
+      fclose(fp);
+    }
+  }
+  fprintf(stderr, "sweep: %s %s: %s\n", workload.file.c_str(),
+      point_values(point, true).c_str(), ok ? "done" : "error");
+}
+
+static void run_workers(const cas_config &base, int num_jobs) {
+  int num_workers = sweep_workers;
+  if(num_workers <= 0) num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if(num_workers > num_jobs) num_workers = num_jobs;
+  fflush(stdout);
+  fflush(stderr);
+  for(int i = 0; i < num_workers; ++i) {
+    pid_t pid = fork();
+    if(pid < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if(pid == 0) {
+      // Claims only ever appear, so a job passed over stays taken.
+      for(int job = 0; job < num_jobs; ++job) {
+        if(claim_job(job)) run_job(base, job);
+      }
+      exit(0);
+    }
+  }
+  while(wait(nullptr) > 0) {}
+}
+
+// Reads the records and writes the table, marking for each workload the
+// configurations not beaten in both time and area by another one.
+static void collect_results(const cas_config &base, int num_jobs) {
+  vector<string> records(num_jobs);
+  int num_missing = 0;
+  for(int job = 0; job < num_jobs; ++job) {
+    FILE *fp = fopen(job_file(job, ".csv").c_str(), "r");
+    if(!fp) {
+      ++num_missing;
+      continue;
+    }
+    char buf[1024];
+    if(fgets(buf, sizeof(buf), fp)) records[job] = trim(buf);
+    fclose(fp);
+  }
+  if(num_missing) {
+    fprintf(stderr, "sweep: %d of %d jobs not finished yet\n",
+        num_missing, num_jobs);
+    return;
+  }
+  vector<double> time(num_jobs), area(num_jobs);
+  vector<bool> ok(num_jobs);
+  for(int job = 0; job < num_jobs; ++job) {
+    cas_config config = point_config(base, job % num_points);
+    ok[job] = records[job] != "error";
+    time[job] = strtoull(records[job].c_str(), nullptr, 10) / config.clk;
+    area[job] = area_cost(config);
+  }
+  FILE *fp = stdout;
+  if(!sweep_output_file.empty()) {
+    fp = fopen(sweep_output_file.c_str(), "w");
+    if(!fp) {
+      fprintf(stderr, "error: cannot open %s\n", sweep_output_file.c_str());
+      exit(1);
+    }
+  }
+  fprintf(fp, "workload");
+  for(const sweep_param &param : params) {
+    fprintf(fp, ",%s", param.name.c_str());
+  }
+  fprintf(fp, ",area,time,%s,pareto\n", cas_result_columns);
+  string empty_record;
+  for(const char *c = cas_result_columns; *c; ++c) {
+    if(*c == ',') empty_record += ',';
+  }
+  for(int job = 0; job < num_jobs; ++job) {
+    int workload = job / num_points;
+    bool pareto = ok[job];
+    for(int other = workload * num_points;
+        pareto && other < (workload+1) * num_points; ++other) {
+      pareto = !(ok[other] &&
+                 time[other] <= time[job] && area[other] <= area[job] &&
+                 (time[other] < time[job] || area[other] < area[job]));
+    }
+    fprintf(fp, "%s%s,%.2f", workloads[workload].file.c_str(),
+        point_values(job % num_points, false).c_str(), area[job]);
+    if(ok[job]) {
+      fprintf(fp, ",%.9f,%s,%d\n", time[job], records[job].c_str(), pareto);
+    } else {
+      fprintf(fp, ",,%s,error\n", empty_record.c_str());
+    }
+  }
+  if(fp != stdout) fclose(fp);
+}
+
+void sweep_main() {
+  if(sweep_file.empty()) {
+    fprintf(stderr, "error: -s sweep needs --sweep\n");
+    exit(1);
+  }
+  read_sweep_file(sweep_file);
+  cas_config base = default_cas_config;
+  if(!cas_config_file.empty()) read_cas_config(cas_config_file, base);
+  for(const string &param : cas_config_params) {
+    set_cas_config_param(param, base);
+  }
+  num_points = 1;
+  for(const sweep_param &param : params) {
+    num_points *= param.values.size();
+  }
+  for(int point = 0; point < num_points; ++point) {
+    check_cas_config(point_config(base, point));
+  }
+  load_workloads();
+  if(mkdir(sweep_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "error: cannot create %s\n", sweep_dir.c_str());
+    exit(1);
+  }
+  int num_jobs = workloads.size() * num_points;
+  make_job_keys(base, num_jobs);
+  run_workers(base, num_jobs);
+  collect_results(base, num_jobs);
+}
@@ -0,0 +1,7 @@
+#ifndef SWEEP_H_
+#define SWEEP_H_
+
+// Runs CAS over a grid of configurations and workloads (-s sweep).
+void sweep_main(void);
+
+#endif /* SWEEP_H_ */